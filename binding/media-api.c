@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <json-c/json.h>
+#include <json-c/printbuf.h>
 
 #define AFB_BINDING_VERSION 3
 #include <afb/afb-binding.h>
@@ -27,6 +28,7 @@
 #include "media-manager.h"
 
 static afb_event_t media_added_event;
+static afb_event_t media_added_chunked_event;
 static afb_event_t media_removed_event;
 
 static gint get_scan_type(afb_req_t request, json_object *jtype) {
@@ -123,6 +125,388 @@ static int get_scan_view(afb_req_t request) {
         return -1;
     }
 }
+static gint get_scan_limit(afb_req_t request) {
+    json_object *jlimit = NULL;
+    gint limit;
+
+    if(!json_object_object_get_ex(afb_req_json(request),"limit",&jlimit)) {
+        return 0;
+    }
+
+    /* Query string arguments arrive as strings, json-c parses both */
+    if(!json_object_is_type(jlimit,json_type_int) &&
+       !json_object_is_type(jlimit,json_type_string)) {
+        afb_req_fail(request,"failed", "invalid limit type");
+        return -1;
+    }
+
+    limit = json_object_get_int(jlimit);
+    if(limit < 1) {
+        afb_req_fail(request,"failed", "invalid limit value");
+        return -1;
+    }
+    return limit;
+}
+
+static gint get_chunk_size(afb_req_t request) {
+    json_object *jchunk = NULL;
+    gint64 chunk_size;
+
+    if(!json_object_object_get_ex(afb_req_json(request),"chunk_size",&jchunk)) {
+        return 0;
+    }
+
+    /* Query string arguments arrive as strings, which must be all digits */
+    if(json_object_is_type(jchunk,json_type_int)) {
+        chunk_size = json_object_get_int64(jchunk);
+    } else if(!json_object_is_type(jchunk,json_type_string) ||
+              !g_ascii_string_to_signed(json_object_get_string(jchunk), 10,
+                                        G_MININT64, G_MAXINT64,
+                                        &chunk_size, NULL)) {
+        afb_req_fail(request,"failed", "invalid chunk_size type");
+        return -1;
+    }
+
+    if(chunk_size < 0 || chunk_size > G_MAXINT) {
+        afb_req_fail(request,"failed", "invalid chunk_size value");
+        return -1;
+    }
+    return chunk_size;
+}
+
+/* Optional mount path of the one device to scan, NULL for all media */
+static gint get_scan_device(afb_req_t request, gchar **uri) {
+    json_object *jdevice = NULL;
+
+    *uri = NULL;
+    if(!json_object_object_get_ex(afb_req_json(request),"device",&jdevice)) {
+        return 0;
+    }
+
+    if(!json_object_is_type(jdevice,json_type_string)) {
+        afb_req_fail(request,"failed", "invalid device type");
+        return -1;
+    }
+
+    if(!media_mount_is_mounted(json_object_get_string(jdevice))) {
+        afb_req_fail(request,"failed", "unknown device");
+        return -1;
+    }
+
+    *uri = g_strdup(json_object_get_string(jdevice));
+    return 0;
+}
+
+/* Optional duration bound of a filter, in ms, -1 when absent */
+static gint get_match_duration(afb_req_t request, json_object *jfilter,
+                               const gchar *key, gint *duration) {
+    json_object *jval = NULL;
+    gint64 value;
+
+    *duration = -1;
+    if(!json_object_object_get_ex(jfilter,key,&jval))
+        return 0;
+
+    if(!json_object_is_type(jval,json_type_int)) {
+        afb_req_fail(request,"failed", "invalid filter duration type");
+        return -1;
+    }
+
+    value = json_object_get_int64(jval);
+    if(value < 0 || value > G_MAXINT) {
+        afb_req_fail(request,"failed", "invalid filter duration value");
+        return -1;
+    }
+    *duration = value;
+    return 0;
+}
+
+/*
+ * Optional "filter" object: "artist", "album" and "genre" the media must
+ * have, "title" their title must start with, and "min_duration" and
+ * "max_duration" in ms.
+ */
+static gint get_scan_match(afb_req_t request, MediaMatch_t **match) {
+    static const gchar *keys[] = { "artist", "album", "genre", "title",
+                                   "min_duration", "max_duration" };
+    gchar **texts[4];
+    json_object *jfilter = NULL;
+    json_object *jval = NULL;
+    MediaMatch_t *m;
+    size_t i;
+    int known;
+
+    *match = NULL;
+    if(!json_object_object_get_ex(afb_req_json(request),"filter",&jfilter)) {
+        return 0;
+    }
+
+    if(!json_object_is_type(jfilter,json_type_object)) {
+        afb_req_fail(request,"failed", "invalid filter type");
+        return -1;
+    }
+
+    for(i = 0, known = 0; i < G_N_ELEMENTS(keys); i++)
+        known += json_object_object_get_ex(jfilter,keys[i],NULL);
+    if(known != json_object_object_length(jfilter)) {
+        afb_req_fail(request,"failed", "unknown filter field");
+        return -1;
+    }
+
+    m = g_malloc0(sizeof(*m));
+    texts[0] = &m->artist;
+    texts[1] = &m->album;
+    texts[2] = &m->genre;
+    texts[3] = &m->title;
+    for(i = 0; i < G_N_ELEMENTS(texts); i++) {
+        if(!json_object_object_get_ex(jfilter,keys[i],&jval))
+            continue;
+        if(!json_object_is_type(jval,json_type_string)) {
+            media_match_free(m);
+            afb_req_fail(request,"failed", "invalid filter text type");
+            return -1;
+        }
+        *texts[i] = g_strdup(json_object_get_string(jval));
+    }
+
+    if(get_match_duration(request, jfilter, "min_duration", &m->min_duration) < 0 ||
+       get_match_duration(request, jfilter, "max_duration", &m->max_duration) < 0) {
+        media_match_free(m);
+        return -1;
+    }
+    if(m->min_duration >= 0 && m->max_duration >= 0 &&
+       m->min_duration > m->max_duration) {
+        media_match_free(m);
+        afb_req_fail(request,"failed", "invalid filter duration range");
+        return -1;
+    }
+
+    *match = m;
+    return 0;
+}
+
+/* Absolute path of the directory to scan again, without trailing '/' */
+static gint get_rescan_path(afb_req_t request, gchar **path) {
+    json_object *jpath = NULL;
+    gchar **parts;
+    gsize len;
+    gint i;
+
+    *path = NULL;
+    if(!json_object_object_get_ex(afb_req_json(request),"path",&jpath) ||
+       !json_object_is_type(jpath,json_type_string)) {
+        afb_req_fail(request,"failed", "invalid path type");
+        return -1;
+    }
+
+    if(!g_path_is_absolute(json_object_get_string(jpath))) {
+        afb_req_fail(request,"failed", "invalid path value");
+        return -1;
+    }
+
+    parts = g_strsplit(json_object_get_string(jpath), "/", -1);
+    for(i = 0; parts[i]; i++) {
+        if(!strcmp(parts[i], "..")) {
+            g_strfreev(parts);
+            afb_req_fail(request,"failed", "invalid path value");
+            return -1;
+        }
+    }
+    g_strfreev(parts);
+
+    *path = g_strdup(json_object_get_string(jpath));
+    len = strlen(*path);
+    while(len > 1 && (*path)[len - 1] == '/')
+        (*path)[--len] = '\0';
+
+    if(!media_scan_path_allowed(*path)) {
+        g_free(*path);
+        *path = NULL;
+        afb_req_fail(request,"failed", "path is not on a media device");
+        return -1;
+    }
+    return 0;
+}
+
+/* Name argument 'key' of the browse verbs, NULL when absent */
+static gint get_browse_name(afb_req_t request, const gchar *key,
+                            gboolean required, const gchar **name) {
+    json_object *jname = NULL;
+
+    *name = NULL;
+    if(!json_object_object_get_ex(afb_req_json(request),key,&jname)) {
+        if(!required)
+            return 0;
+        afb_req_fail_f(request,"failed", "missing %s", key);
+        return -1;
+    }
+
+    if(!json_object_is_type(jname,json_type_string)) {
+        afb_req_fail_f(request,"failed", "invalid %s type", key);
+        return -1;
+    }
+
+    *name = json_object_get_string(jname);
+    return 0;
+}
+
+static const struct {
+    const gchar *name;
+    gint field;
+} media_fields[] = {
+    { "path",     MEDIA_FIELD_PATH },
+    { "type",     MEDIA_FIELD_TYPE },
+    { "title",    MEDIA_FIELD_TITLE },
+    { "artist",   MEDIA_FIELD_ARTIST },
+    { "album",    MEDIA_FIELD_ALBUM },
+    { "genre",    MEDIA_FIELD_GENRE },
+    { "duration", MEDIA_FIELD_DURATION },
+};
+
+static gint get_field(const gchar *name) {
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(media_fields); i++) {
+        if(!strcasecmp(name, media_fields[i].name))
+            return media_fields[i].field;
+    }
+    return 0;
+}
+
+/*
+ * Optional item fields to report, as an array of names or a comma
+ * separated list of them, 0 for all. The path is always reported.
+ */
+static gint get_scan_fields(afb_req_t request) {
+    json_object *jfields = NULL;
+    gchar **names = NULL;
+    gint fields = MEDIA_FIELD_PATH;
+    gint field;
+    size_t i, n;
+
+    if(!json_object_object_get_ex(afb_req_json(request),"fields",&jfields)) {
+        return 0;
+    }
+
+    if(json_object_is_type(jfields,json_type_string)) {
+        names = g_strsplit(json_object_get_string(jfields), ",", -1);
+    } else if(json_object_is_type(jfields,json_type_array)) {
+        n = json_object_array_length(jfields);
+        names = g_new0(gchar *, n + 1);
+        for(i = 0; i < n; i++) {
+            json_object *jname = json_object_array_get_idx(jfields, i);
+
+            names[i] = g_strdup(json_object_is_type(jname,json_type_string) ?
+                                json_object_get_string(jname) : "");
+        }
+    } else {
+        afb_req_fail(request,"failed", "invalid fields type");
+        return -1;
+    }
+
+    for(i = 0; names[i]; i++) {
+        field = get_field(g_strstrip(names[i]));
+        if(!field) {
+            g_strfreev(names);
+            afb_req_fail(request,"failed", "Unknown field");
+            return -1;
+        }
+        fields |= field;
+    }
+    g_strfreev(names);
+    return fields;
+}
+
+static gint get_scan_cursor(afb_req_t request, MediaCursor_t **cursor) {
+    json_object *jcursor = NULL;
+
+    *cursor = NULL;
+    if(!json_object_object_get_ex(afb_req_json(request),"cursor",&jcursor)) {
+        return 0;
+    }
+
+    if(!json_object_is_type(jcursor,json_type_string)) {
+        afb_req_fail(request,"failed", "invalid cursor type");
+        return -1;
+    }
+
+    *cursor = media_cursor_decode(json_object_get_string(jcursor));
+    if(*cursor == NULL) {
+        afb_req_fail(request,"failed", "invalid cursor value");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * media_added chunk sizes of the subscribed sessions, each session
+ * keeping its own in its context. Sessions that asked for chunks are
+ * subscribed to media_added_chunked_event, the others to
+ * media_added_event, both named "media_added": a device goes out whole
+ * to the latter, and in chunks of the smallest size asked for to the
+ * former.
+ */
+static struct {
+    GMutex m;
+    GList *sizes;           /* gint chunk size of each session, 0 for none */
+} subscribers = { 0 };
+
+static void media_chunk_size_free(void *data)
+{
+    g_mutex_lock(&subscribers.m);
+    subscribers.sizes = g_list_remove(subscribers.sizes, data);
+    g_mutex_unlock(&subscribers.m);
+    g_free(data);
+}
+
+/*
+ * Record the chunk size of the session of 'request', replacing its last
+ * one, and subscribe it to the matching media_added event
+ */
+static void media_chunk_size_set(afb_req_t request, gint chunk_size)
+{
+    gint *size = g_new(gint, 1);
+
+    *size = chunk_size;
+    afb_req_context_set(request, size, media_chunk_size_free);
+
+    g_mutex_lock(&subscribers.m);
+    subscribers.sizes = g_list_prepend(subscribers.sizes, size);
+    g_mutex_unlock(&subscribers.m);
+
+    if(chunk_size > 0) {
+        afb_req_unsubscribe(request, media_added_event);
+        afb_req_subscribe(request, media_added_chunked_event);
+    } else {
+        afb_req_unsubscribe(request, media_added_chunked_event);
+        afb_req_subscribe(request, media_added_event);
+    }
+}
+
+/*
+ * Smallest chunk size of the subscribed sessions, 0 when none asked for
+ * chunks, and in 'whole' whether a session asked for none
+ */
+static gint media_chunk_size_get(gboolean *whole)
+{
+    GList *l;
+    gint size = 0;
+
+    *whole = FALSE;
+    g_mutex_lock(&subscribers.m);
+    for (l = subscribers.sizes; l; l = l->next) {
+        const gint chunk_size = *(gint *) l->data;
+
+        if (chunk_size == 0)
+            *whole = TRUE;
+        else if (size == 0 || chunk_size < size)
+            size = chunk_size;
+    }
+    g_mutex_unlock(&subscribers.m);
+
+    return size;
+}
+
 /*
  * @brief Subscribe for an event
  *
@@ -137,17 +521,23 @@ static void subscribe(afb_req_t request)
         if(!strcasecmp(value, "media_added")) {
             gint scan_type = 0;
             gint view_type = 0;
+            gint chunk_size = 0;
 
-            afb_req_subscribe(request, media_added_event);
-            //Get scan types & append them to mediascan config
+            /* Nothing changes unless every argument is valid */
             scan_type = get_scan_types(request);
             if(scan_type < 0)
             return;
-            ScanTypeAppend(scan_type);
             view_type = get_scan_view(request);
             if(view_type < 1)
             return;
+            chunk_size = get_chunk_size(request);
+            if(chunk_size < 0)
+            return;
+
+            //Append scan types to mediascan config
+            ScanTypeAppend(scan_type);
             setAPIMediaListView(view_type);
+            media_chunk_size_set(request, chunk_size);
         } else if(!strcasecmp(value, "media_removed")) {
             afb_req_subscribe(request, media_removed_event);
         } else {
@@ -190,6 +580,8 @@ static void unsubscribe(afb_req_t request)
 	if(value) {
 		if(!strcasecmp(value, "media_added")) {
 			afb_req_unsubscribe(request, media_added_event);
+			afb_req_unsubscribe(request, media_added_chunked_event);
+			afb_req_context_clear(request);
 		} else if(!strcasecmp(value, "media_removed")) {
 			afb_req_unsubscribe(request, media_removed_event);
 		} else {
@@ -200,200 +592,671 @@ static void unsubscribe(afb_req_t request)
 	afb_req_success(request, NULL, NULL);
 }
 
-static gint
-media_jlist_from_media_list(MediaList_t *mlist, const gint view, json_object *jarray)
+/*
+ * Streaming JSON output
+ *
+ * Replies are written straight into one growable buffer instead of
+ * being built as a json-c object tree, and handed to afb wrapped in a
+ * json_object whose serializer just copies the buffer out. afb emits
+ * the buffer as is, and a cached reply is served the same way, so a
+ * cache hit costs a copy of the bytes. The json-c tree of a reply is
+ * only built for code of this process reading its members, through
+ * media_json_expand().
+ */
+
+static const gchar json_hex[] = "0123456789abcdef";
+
+static void json_append_string(GString *out, const gchar *str)
 {
-    json_object *jstring = NULL;
-    GList *l;
-    gint num = 0;
-    const GList *list = mlist->list;
-    const char *scan_type = mlist->scan_type_str;
+    const guchar *p = (const guchar *) str;
+    const guchar *run = p;
 
-    for (l = list; l; l = l->next)
-    {
-        MediaItem_t *item = l->data;
-        json_object *jdict = json_object_new_object();
-
-        jstring = json_object_new_string(item->path);
-        json_object_object_add(jdict, "path", jstring);
-        if(view == MEDIA_LIST_VIEW_DEFAULT) {
-            jstring = json_object_new_string(scan_type);
-            json_object_object_add(jdict, "type", jstring);
-        }
+    g_string_append_c(out, '"');
+    for (; *p; p++) {
+        if (*p >= 0x20 && *p != '"' && *p != '\\')
+            continue;
 
-        if (item->metadata.title) {
-            jstring = json_object_new_string(item->metadata.title);
-            json_object_object_add(jdict, "title", jstring);
+        g_string_append_len(out, (const gchar *) run, p - run);
+        switch (*p) {
+            case '"':  g_string_append(out, "\\\""); break;
+            case '\\': g_string_append(out, "\\\\"); break;
+            case '\b': g_string_append(out, "\\b"); break;
+            case '\f': g_string_append(out, "\\f"); break;
+            case '\n': g_string_append(out, "\\n"); break;
+            case '\r': g_string_append(out, "\\r"); break;
+            case '\t': g_string_append(out, "\\t"); break;
+            default:
+                g_string_append(out, "\\u00");
+                g_string_append_c(out, json_hex[*p >> 4]);
+                g_string_append_c(out, json_hex[*p & 0xf]);
         }
+        run = p + 1;
+    }
+    g_string_append_len(out, (const gchar *) run, p - run);
+    g_string_append_c(out, '"');
+}
 
-        if (item->metadata.artist) {
-            jstring = json_object_new_string(item->metadata.artist);
-            json_object_object_add(jdict, "artist", jstring);
-        }
+/* Append ',"key":"value"', or nothing when value is NULL */
+static void json_append_member(GString *out, const gchar *key, const gchar *value)
+{
+    if (!value)
+        return;
 
-        if (item->metadata.album) {
-            jstring = json_object_new_string(item->metadata.album);
-            json_object_object_add(jdict, "album", jstring);
-        }
+    g_string_append_printf(out, ",\"%s\":", key);
+    json_append_string(out, value);
+}
 
-        if (item->metadata.genre) {
-            jstring = json_object_new_string(item->metadata.genre);
-            json_object_object_add(jdict, "genre", jstring);
-        }
+static int json_bytes_serialize(json_object *jso, struct printbuf *pb,
+                                int level, int flags)
+{
+    gsize len;
+    const gchar *data = g_bytes_get_data(json_object_get_userdata(jso), &len);
 
-        if (item->metadata.duration) {
-            json_object *jint = json_object_new_int(item->metadata.duration);
-            json_object_object_add(jdict, "duration", jint);
-        }
+    return printbuf_memappend(pb, data, (int) len);
+}
 
-        json_object_array_add(jarray, jdict);
-        num++;
-    }
+static void json_bytes_free(json_object *jso, void *userdata)
+{
+    g_bytes_unref(userdata);
+}
 
-    if (jstring == NULL)
-        return -1;
+/*
+ * Wrap already serialized JSON into a json_object for afb. The object
+ * takes its own reference on 'bytes'. Its members are only there once
+ * media_json_expand() parsed them: until then it only shows its content
+ * when serialized.
+ */
+static json_object *json_object_new_serialized(GBytes *bytes)
+{
+    json_object *jso = json_object_new_object();
 
-    return num;
+    json_object_set_serializer(jso, json_bytes_serialize,
+                               g_bytes_ref(bytes), json_bytes_free);
+    return jso;
 }
 
-static json_object* media_device_scan(ScanFilter_t *filter, gchar **error)
+/*
+ * Turn a json_object_new_serialized() object into the plain json-c tree
+ * of its JSON, in place, and return it. json-c has no hook building
+ * members as they are looked up, so code reading a reply in process
+ * calls this first. Other objects are returned as they are.
+ */
+json_object *media_json_expand(json_object *jso)
 {
-    json_object *jresp = NULL;
-    json_object *jlist = NULL;
-    MediaList_t *mlist = NULL;
-    MediaDevice_t *mdev = NULL;
-    gint res = -1;
-    gint num = 0;
-    gint i;
+    struct json_tokener *tok;
+    json_object *jtree = NULL;
+    GBytes *bytes;
+    const gchar *data;
+    gsize len;
 
-    if(!filter){
-        *error = g_strdup("NULL filter!");
-        return NULL;
-    }
-    if(!filter->scan_types)
-        return NULL;
+    if (!jso || !json_object_is_type(jso, json_type_object))
+        return jso;
+    bytes = json_object_get_userdata(jso);
+    if (!bytes)
+        return jso;
 
-    mdev = g_malloc0(sizeof(*mdev));
-    if(!mdev){
-        *error = g_strdup("Cannot allocate memory.");
-        return NULL;
+    data = g_bytes_get_data(bytes, &len);
+    tok = json_tokener_new();
+    if (tok) {
+        jtree = json_tokener_parse_ex(tok, data, (int) len);
+        json_tokener_free(tok);
     }
-
-    for( i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
-    {
-        if(filter->scan_types & (1 << i))
-        {
-            mdev->lists[i] = g_malloc0(sizeof(MediaList_t));
-            if(!mdev->lists[i]){
-                media_device_free(mdev);
-                *error = g_strdup("Cannot allocate memory to media-list object");
-                return NULL;
-            }
-        }
+    if (jtree) {
+        json_object_object_foreach(jtree, key, val)
+            json_object_object_add(jso, key, json_object_get(val));
+        json_object_put(jtree);
+    } else {
+        LOGE("Cannot parse a serialized reply\n");
     }
-    mdev->filters = filter;
 
-    res = media_lists_get(mdev,error);
-    if(res < 0)
+    /* Back to the default serializer, dropping the buffer */
+    json_object_set_serializer(jso, NULL, NULL, NULL);
+    return jso;
+}
+
+/* Rough size of one serialized item, used to presize reply buffers */
+#define MEDIA_JSON_ITEM_SIZE 192
+
+/*
+ * Append the object of one item, with its 'scan_type' unless NULL, and
+ * only the MEDIA_FIELD_* of 'fields' besides its path, 0 for all of them.
+ */
+static void media_json_append_item(GString *out, const MediaItem_t *item,
+                                   const gchar *scan_type, gint fields)
+{
+    if (!fields)
+        fields = MEDIA_FIELD_ALL;
+
+    g_string_append(out, "{\"path\":");
+    json_append_string(out, item->path);
+    if (fields & MEDIA_FIELD_TYPE)
+        json_append_member(out, "type", scan_type);
+
+    if (fields & MEDIA_FIELD_TITLE)
+        json_append_member(out, "title", item->metadata.title);
+    if (fields & MEDIA_FIELD_ARTIST)
+        json_append_member(out, "artist", item->metadata.artist);
+    if (fields & MEDIA_FIELD_ALBUM)
+        json_append_member(out, "album", item->metadata.album);
+    if (fields & MEDIA_FIELD_GENRE)
+        json_append_member(out, "genre", item->metadata.genre);
+
+    if ((fields & MEDIA_FIELD_DURATION) && item->metadata.duration)
+        g_string_append_printf(out, ",\"duration\":%d", item->metadata.duration);
+
+    g_string_append_c(out, '}');
+}
+
+static gint
+media_json_append_list(GString *out, MediaList_t *mlist, const gint view,
+                       gint fields, gboolean first)
+{
+    guint i;
+    gint num = 0;
+    const char *scan_type = mlist->scan_type_str;
+
+    for (i = 0; i < mlist->items->len; i++)
     {
-        media_device_free(mdev);
-        return NULL;
+        MediaItem_t *item = &g_array_index(mlist->items, MediaItem_t, i);
+
+        if (!first)
+            g_string_append_c(out, ',');
+        first = FALSE;
+
+        media_json_append_item(out, item,
+                               view == MEDIA_LIST_VIEW_DEFAULT ? scan_type : NULL,
+                               fields);
+        num++;
     }
 
-    if(filter->listview_type == MEDIA_LIST_VIEW_CLUSTERD)
+    return num;
+}
+
+/* Append the '"Media":' member holding every item of mdev */
+static void media_json_append_media(GString *out, MediaDevice_t *mdev)
+{
+    MediaList_t *mlist = NULL;
+    gboolean first = TRUE;
+    gint i;
+
+    g_string_append(out, "\"Media\":");
+
+    if(mdev->filters->listview_type == MEDIA_LIST_VIEW_CLUSTERD)
     {
-        jlist = json_object_new_object();
+        g_string_append_c(out, '{');
         for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
         {
-            json_object *typed_arr = json_object_new_array();
             mlist = mdev->lists[i];
             if(mlist != NULL)
             {
-                res = media_jlist_from_media_list(mlist,MEDIA_LIST_VIEW_CLUSTERD,typed_arr);
-                if(res < 0)
-                {
-                    *error = g_strdup("media parsing error");
-                    media_device_free(mdev);
-                    json_object_put(jlist);
-                    return NULL;
-                }
-                json_object_object_add(jlist,lms_scan_types[i],typed_arr);
-                num += res;
+                g_string_append_printf(out, "%s\"%s\":[", first ? "" : ",",
+                                       lms_scan_types[i]);
+                media_json_append_list(out, mlist, MEDIA_LIST_VIEW_CLUSTERD,
+                                       mdev->filters->fields, TRUE);
+                g_string_append_c(out, ']');
+                first = FALSE;
             }
         }
+        g_string_append_c(out, '}');
     }
     else
     {
-        jlist = json_object_new_array();
+        g_string_append_c(out, '[');
         for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
         {
             mlist = mdev->lists[i];
             if(mlist != NULL)
             {
-                res = media_jlist_from_media_list(mlist,MEDIA_LIST_VIEW_DEFAULT,jlist);
-                if(res < 0)
-                {
-                    *error = g_strdup("media parsing error");
-                    media_device_free(mdev);
-                    json_object_put(jlist);
-                    return NULL;
-                }
-                num += res;
+                if(media_json_append_list(out, mlist, MEDIA_LIST_VIEW_DEFAULT,
+                                          mdev->filters->fields, first) > 0)
+                    first = FALSE;
             }
         }
+        g_string_append_c(out, ']');
     }
-    media_device_free(mdev);
-
-    jresp = json_object_new_object();
-    json_object_object_add(jresp, "Media", jlist);
-    return jresp;
 }
 
-static void media_results_get (afb_req_t request)
+/* Output buffer sized for the items of mdev, opened with '{' */
+static GString *media_json_new(MediaDevice_t *mdev)
 {
-    json_object *jresp = NULL;
-    gchar *error = NULL;
-    gint scan_types = 0;
-    ScanFilter_t filter;
-
-    filter.scan_types = get_scan_types(request);
-    if(filter.scan_types < 0)
-        return;
-    filter.listview_type = get_scan_view(request);
-    filter.scan_uri = SCAN_URI_DEFAULT;
-
-    ListLock();
-    jresp = media_device_scan(&filter,&error);
-    ListUnlock();
+    GString *out;
+    gsize items = 0;
+    gint i;
 
-    if (jresp == NULL)
+    for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
     {
-        afb_req_fail(request, "failed", error);
-        LOGE(" %s",error);
-        g_free(error);
-        return;
+        if(mdev->lists[i] != NULL)
+            items += mdev->lists[i]->items->len;
     }
 
-    afb_req_success(request, jresp, "Media Results Displayed");
+    out = g_string_sized_new(64 + items * MEDIA_JSON_ITEM_SIZE);
+    g_string_append_c(out, '{');
+    return out;
 }
 
-static void media_broadcast_device_added (ScanFilter_t *filters)
+/* Scan the media matching 'filter' */
+static MediaDevice_t* media_device_scan(ScanFilter_t *filter, gchar **error)
 {
-    json_object *jresp = NULL;
-    gchar *error = NULL;
+    MediaDevice_t *mdev = NULL;
 
-    ListLock();
-    jresp = media_device_scan(filters,&error);
-    ListUnlock();
+    if(!filter){
+        *error = g_strdup("NULL filter!");
+        return NULL;
+    }
+    if(!filter->scan_types)
+        return NULL;
 
-    if (jresp == NULL)
+    mdev = media_device_new(filter);
+
+    if(media_lists_get(mdev,error) < 0)
+    {
+        media_device_free(mdev);
+        return NULL;
+    }
+
+    return mdev;
+}
+
+/* Serialize the {"Media": ..., "cursor": ...} reply of media_result */
+static GBytes* media_results_serialize(MediaDevice_t *mdev)
+{
+    GString *out = media_json_new(mdev);
+
+    media_json_append_media(out, mdev);
+    if(mdev->next_cursor)
+    {
+        gchar *cursor = media_cursor_encode(mdev->next_cursor);
+        json_append_member(out, "cursor", cursor);
+        g_free(cursor);
+    }
+    g_string_append_c(out, '}');
+
+    return g_string_free_to_bytes(out);
+}
+
+/*
+ * media_result workers
+ *
+ * A reply that is not cached is computed on a bounded pool of workers,
+ * so that the verb returns at once and a slow scan never holds a binder
+ * thread. Requests wait in the pool queue when every worker is busy, and
+ * are refused once too many of them wait.
+ */
+#define MEDIA_WORKER_QUEUE_MAX  64
+
+typedef struct {
+    afb_req_t request;      /* referenced until the reply is sent */
+    ScanFilter_t filter;
+    gchar *key;             /* response cache key */
+    guint generation;       /* response cache generation at lookup */
+    gint64 queued;          /* monotonic time the job was queued at */
+} MediaResultJob_t;
+
+static struct {
+    GThreadPool *pool;
+    GMutex m;               /* protects the counters below */
+    guint queued;           /* jobs pushed and not started yet */
+    guint64 processed;      /* jobs run */
+    guint64 rejected;       /* jobs refused on a full queue */
+    guint queue_peak;       /* deepest queue seen */
+    gint64 wait_total;      /* queue wait of all jobs run, in us */
+    gint64 wait_peak;       /* longest queue wait, in us */
+} workers = { 0 };
+
+/* Scan, cache and send the reply of a media_result request */
+static void media_results_run(MediaResultJob_t *job)
+{
+    MediaDevice_t *mdev = NULL;
+    GBytes *jresp = NULL;
+    gchar *error = NULL;
+
+    mdev = media_device_scan(&job->filter,&error);
+    if (mdev == NULL)
+    {
+        afb_req_fail(job->request, "failed", error);
+        LOGE(" %s",error);
+        g_free(error);
+        return;
+    }
+
+    jresp = media_results_serialize(mdev);
+    /* A reply read while LMS was busy must not outlive its update */
+    if (!media_device_is_stale(mdev))
+        media_cache_insert(job->key, job->generation, jresp);
+    media_device_free(mdev);
+
+    afb_req_success(job->request, json_object_new_serialized(jresp), "Media Results Displayed");
+    g_bytes_unref(jresp);
+}
+
+static void media_result_job_free(MediaResultJob_t *job)
+{
+    media_cursor_free(job->filter.cursor);
+    media_match_free(job->filter.match);
+    g_free(job->filter.scan_uri);
+    g_free(job->key);
+    g_free(job);
+}
+
+static void media_results_worker(gpointer data, gpointer unused)
+{
+    MediaResultJob_t *job = data;
+    const gint64 wait = g_get_monotonic_time() - job->queued;
+
+    g_mutex_lock(&workers.m);
+    workers.queued--;
+    workers.processed++;
+    workers.wait_total += wait;
+    if (wait > workers.wait_peak)
+        workers.wait_peak = wait;
+    g_mutex_unlock(&workers.m);
+
+    media_results_run(job);
+    afb_req_unref(job->request);
+    media_result_job_free(job);
+}
+
+/* Hand 'job' to the workers, FALSE if they are too far behind */
+static gboolean media_results_queue(MediaResultJob_t *job)
+{
+    g_mutex_lock(&workers.m);
+    if (workers.queued >= MEDIA_WORKER_QUEUE_MAX) {
+        workers.rejected++;
+        g_mutex_unlock(&workers.m);
+        return FALSE;
+    }
+    if (++workers.queued > workers.queue_peak)
+        workers.queue_peak = workers.queued;
+    g_mutex_unlock(&workers.m);
+
+    job->request = afb_req_addref(job->request);
+    job->queued = g_get_monotonic_time();
+    g_thread_pool_push(workers.pool, job, NULL);
+    return TRUE;
+}
+
+static void media_results_get (afb_req_t request)
+{
+    MediaResultJob_t *job = NULL;
+    GBytes *jresp = NULL;
+    ScanFilter_t filter;
+
+    filter.scan_types = get_scan_types(request);
+    if(filter.scan_types < 0)
+        return;
+    filter.listview_type = get_scan_view(request);
+    if(filter.listview_type < 0)
+        return;
+    filter.limit = get_scan_limit(request);
+    if(filter.limit < 0)
+        return;
+    if(get_scan_device(request, &filter.scan_uri) < 0)
+        return;
+    filter.scan_paths = NULL;
+    if(get_scan_cursor(request, &filter.cursor) < 0) {
+        g_free(filter.scan_uri);
+        return;
+    }
+    if(get_scan_match(request, &filter.match) < 0) {
+        media_cursor_free(filter.cursor);
+        g_free(filter.scan_uri);
+        return;
+    }
+    filter.fields = get_scan_fields(request);
+    if(filter.fields < 0) {
+        media_match_free(filter.match);
+        media_cursor_free(filter.cursor);
+        g_free(filter.scan_uri);
+        return;
+    }
+
+    job = g_malloc0(sizeof(*job));
+    job->request = request;
+    job->filter = filter;
+
+    /* Same request against the same database contents, same reply */
+    job->key = media_cache_key(&filter);
+    jresp = media_cache_lookup(job->key, &job->generation);
+    if (jresp != NULL) {
+        afb_req_success(request, json_object_new_serialized(jresp), "Media Results Displayed");
+        g_bytes_unref(jresp);
+        media_result_job_free(job);
+        return;
+    }
+
+    if (workers.pool == NULL) {
+        media_results_run(job);
+        media_result_job_free(job);
+    } else if (!media_results_queue(job)) {
+        afb_req_fail(request, "failed", "too many pending requests");
+        media_result_job_free(job);
+    }
+}
+
+static void stats (afb_req_t request)
+{
+    json_object *jresp = json_object_new_object();
+    json_object *jworkers = json_object_new_object();
+    json_object *jrefresh = json_object_new_object();
+    json_object *jscan = json_object_new_object();
+    json_object *jwatch = json_object_new_object();
+    MediaRefreshStats_t refresh;
+    MediaScanStats_t scan;
+    MediaWatchStats_t watch;
+
+    g_mutex_lock(&workers.m);
+    json_object_object_add(jworkers, "threads",
+        json_object_new_int(workers.pool ? MEDIA_WORKER_THREADS : 0));
+    json_object_object_add(jworkers, "queue_depth",
+        json_object_new_int(workers.queued));
+    json_object_object_add(jworkers, "queue_peak",
+        json_object_new_int(workers.queue_peak));
+    json_object_object_add(jworkers, "processed",
+        json_object_new_int64(workers.processed));
+    json_object_object_add(jworkers, "rejected",
+        json_object_new_int64(workers.rejected));
+    json_object_object_add(jworkers, "wait_avg_us",
+        json_object_new_int64(workers.processed ?
+                              workers.wait_total / (gint64) workers.processed : 0));
+    json_object_object_add(jworkers, "wait_peak_us",
+        json_object_new_int64(workers.wait_peak));
+    g_mutex_unlock(&workers.m);
+
+    media_refresh_stats(&refresh);
+    json_object_object_add(jrefresh, "signals", json_object_new_int64(refresh.signals));
+    json_object_object_add(jrefresh, "coalesced", json_object_new_int64(refresh.coalesced));
+    json_object_object_add(jrefresh, "unchanged", json_object_new_int64(refresh.unchanged));
+    json_object_object_add(jrefresh, "refreshes", json_object_new_int64(refresh.refreshes));
+
+    media_scan_stats(&scan);
+    json_object_object_add(jscan, "requests", json_object_new_int64(scan.requests));
+    json_object_object_add(jscan, "merged", json_object_new_int64(scan.merged));
+    json_object_object_add(jscan, "issued", json_object_new_int64(scan.issued));
+    json_object_object_add(jscan, "refused", json_object_new_int64(scan.refused));
+
+    media_watch_stats(&watch);
+    json_object_object_add(jwatch, "watches", json_object_new_int64(watch.watches));
+    json_object_object_add(jwatch, "overflows", json_object_new_int64(watch.overflows));
+    json_object_object_add(jwatch, "truncated", json_object_new_int64(watch.truncated));
+
+    json_object_object_add(jresp, "media_result", jworkers);
+    json_object_object_add(jresp, "refresh", jrefresh);
+    json_object_object_add(jresp, "scan", jscan);
+    json_object_object_add(jresp, "watch", jwatch);
+    afb_req_success(request, jresp, "Service statistics");
+}
+
+/* Push a media_added event to every session, chunked or not */
+static void media_added_push(GBytes *jresp)
+{
+    json_object *jevent = json_object_new_serialized(jresp);
+
+    afb_event_push(media_added_chunked_event, json_object_get(jevent));
+    afb_event_push(media_added_event, jevent);
+}
+
+/* A chunked media_added sequence, see media_broadcast_chunk() */
+typedef struct {
+    guint id;               /* sequence id */
+    guint seq;              /* number of the next chunk */
+} MediaChunkSeq_t;
+
+/*
+ * Push one media_added event of a chunked sequence to the sessions that
+ * asked for chunks: the items of mdev tagged with the sequence id, the
+ * chunk number and whether it is the last chunk.
+ */
+static void media_broadcast_chunk(MediaDevice_t *mdev, gint items,
+                                  gboolean complete, gpointer data)
+{
+    MediaChunkSeq_t *seq = data;
+    GString *out;
+    GBytes *jresp;
+
+    out = media_json_new(mdev);
+    media_json_append_media(out, mdev);
+    g_string_append_printf(out, ",\"id\":%u,\"seq\":%u,\"complete\":%s}",
+                           seq->id, seq->seq++, complete ? "true" : "false");
+
+    jresp = g_string_free_to_bytes(out);
+    afb_event_push(media_added_chunked_event, json_object_new_serialized(jresp));
+    g_bytes_unref(jresp);
+}
+
+/*
+ * Deliver the device in chunks of 'chunk_size' items, leaving out what
+ * was announced while LMS indexed it. The device is read by a single
+ * pass over its rows, each chunk going out as soon as its rows are read,
+ * so subscribers can start rendering before the whole device has been
+ * read. Chunks come in path order rather than in the order of the
+ * listing. Returns the number of items delivered, or -1.
+ */
+static gint media_broadcast_device_chunked (ScanFilter_t *filters,
+                                            gint chunk_size,
+                                            GHashTable *announced)
+{
+    static guint broadcast_id = 0;
+    MediaChunkSeq_t seq = { ++broadcast_id, 0 };
+    MediaDevice_t *mdev = media_device_new(filters);
+    gchar *error = NULL;
+    gint items;
+
+    items = media_device_stream(mdev, chunk_size, announced,
+                                media_broadcast_chunk, &seq, &error);
+    if (items < 0)
+    {
+        LOGE("ERROR:%s\n",error);
+        g_free(error);
+        /* Still tell subscribers that nothing more is coming */
+        media_broadcast_chunk(mdev, 0, TRUE, &seq);
+    }
+    media_device_free(mdev);
+
+    return items;
+}
+
+/*
+ * Announce a device to the subscribed sessions: whole to the ones that
+ * did not ask for chunks, in chunks to the others. With both kinds of
+ * sessions, the device is read once for each.
+ */
+static void media_broadcast_device_added (ScanFilter_t *filters)
+{
+    MediaDevice_t *mdev = NULL;
+    GBytes *jresp = NULL;
+    gchar *error = NULL;
+    GHashTable *announced = media_mount_announced(filters->scan_uri);
+    gboolean whole;
+    gint chunk_size = media_chunk_size_get(&whole);
+    gint items;
+
+    /* Before media_device_drop_seen() adds the device to 'announced' */
+    if (chunk_size > 0)
+    {
+        items = media_broadcast_device_chunked(filters, chunk_size, announced);
+        if (!whole && items >= 0)
+            media_mount_account(filters->scan_uri, items);
+    }
+    if (!whole)
+        return;
+
+    mdev = media_device_scan(filters,&error);
+
+    if (mdev == NULL)
     {
         LOGE("ERROR:%s\n",error);
         g_free(error);
         return;
     }
 
-    afb_event_push(media_added_event, jresp);
+    /* Only what was not announced while LMS was indexing the device */
+    items = announced ? media_device_drop_seen(mdev, announced) :
+                        media_device_count(mdev);
+    media_mount_account(filters->scan_uri, items);
+
+    jresp = media_results_serialize(mdev);
+    media_device_free(mdev);
+
+    afb_event_push(media_added_event, json_object_new_serialized(jresp));
+    g_bytes_unref(jresp);
+}
+
+/*
+ * Announce the media LMS committed in 'mdev' while it is still scanning
+ * 'device', leaving out what was announced already. The event carries
+ * "scanning":true, the final event of the scan does not.
+ */
+static void media_broadcast_device_progress (MediaDevice_t *mdev, const char *device)
+{
+    GHashTable *announced = media_mount_announced(device);
+    GString *out;
+    GBytes *jresp;
+    gint items;
+
+    if (announced == NULL)
+        return;
+
+    items = media_device_drop_seen(mdev, announced);
+    if (items == 0)
+        return;
+    media_mount_account(device, items);
+
+    out = media_json_new(mdev);
+    media_json_append_media(out, mdev);
+    g_string_append(out, ",\"scanning\":true}");
+
+    jresp = g_string_free_to_bytes(out);
+    media_added_push(jresp);
+    g_bytes_unref(jresp);
+}
+
+/* Announce the media that appeared on a device already announced */
+static void media_broadcast_device_changed (ScanFilter_t *filters)
+{
+    MediaDevice_t *mdev = NULL;
+    GBytes *jresp;
+    gchar *error = NULL;
+
+    mdev = media_device_scan(filters,&error);
+    if (mdev == NULL)
+    {
+        if (error)
+            LOGE("ERROR:%s\n",error);
+        g_free(error);
+        return;
+    }
+
+    if (media_device_count(mdev) == 0)
+    {
+        media_device_free(mdev);
+        return;
+    }
+
+    jresp = media_results_serialize(mdev);
+    media_device_free(mdev);
+
+    media_added_push(jresp);
+    g_bytes_unref(jresp);
 }
 
 static void media_broadcast_device_removed (const char *obj_path)
@@ -406,23 +1269,397 @@ static void media_broadcast_device_removed (const char *obj_path)
     afb_event_push(media_removed_event, jresp);
 }
 
+static void device_to_json(const MediaMount_t *mount, gpointer data)
+{
+    json_object *jdevices = data;
+    json_object *jdevice = json_object_new_object();
+
+    json_object_object_add(jdevice, "path", json_object_new_string(mount->path));
+    json_object_object_add(jdevice, "state",
+        json_object_new_string(media_mount_state_name(mount->state)));
+    json_object_object_add(jdevice, "mounted",
+        json_object_new_int64(mount->mounted / G_USEC_PER_SEC));
+    if (mount->ready)
+        json_object_object_add(jdevice, "ready",
+            json_object_new_int64(mount->ready / G_USEC_PER_SEC));
+    json_object_object_add(jdevice, "events", json_object_new_int64(mount->events));
+    json_object_object_add(jdevice, "media", json_object_new_int64(mount->media));
+
+    json_object_array_add(jdevices, jdevice);
+}
+
+static void devices (afb_req_t request)
+{
+    json_object *jresp = json_object_new_object();
+    json_object *jdevices = json_object_new_array();
+
+    media_mounts_foreach(device_to_json, jdevices);
+    json_object_object_add(jresp, "Devices", jdevices);
+
+    afb_req_success(request, jresp, "Devices");
+}
+
+/* Media counts of every mounted device, or of the one given as "device" */
+static void summary (afb_req_t request)
+{
+    MediaSummary_t *summary;
+    json_object *jresp, *jdevices;
+    gchar *device = NULL;
+    gchar *error = NULL;
+    guint i;
+    gint id;
+
+    if(get_scan_device(request, &device) < 0)
+        return;
+
+    summary = media_summary(device, &error);
+    g_free(device);
+    if (summary == NULL) {
+        afb_req_fail(request, "failed", error);
+        g_free(error);
+        return;
+    }
+
+    jresp = json_object_new_object();
+    jdevices = json_object_new_array();
+    json_object_object_add(jresp, "update_id",
+                           json_object_new_int64(summary->update_id));
+    for (i = 0; i < summary->devices->len; i++) {
+        const MediaSummaryDevice_t *dev = &g_array_index(summary->devices,
+                                                         MediaSummaryDevice_t, i);
+        json_object *jdevice = json_object_new_object();
+
+        json_object_object_add(jdevice, "path", json_object_new_string(dev->path));
+        for (id = LMS_MIN_ID; id < LMS_SCAN_COUNT; ++id) {
+            const MediaSummaryCount_t *count = &dev->counts[id];
+            json_object *jcount = json_object_new_object();
+
+            json_object_object_add(jcount, "count", json_object_new_int(count->count));
+            json_object_object_add(jcount, "duration",
+                                   json_object_new_int64(count->duration));
+            json_object_object_add(jcount, "update_id",
+                                   json_object_new_int64(count->update_id));
+            json_object_object_add(jdevice, lms_scan_types[id], jcount);
+        }
+        json_object_array_add(jdevices, jdevice);
+    }
+    json_object_object_add(jresp, "Devices", jdevices);
+    media_summary_free(summary);
+
+    afb_req_success(request, jresp, "Summary");
+}
+
+/* Media best matching the "query" text, as {"Media": [...]} */
+static void search (afb_req_t request)
+{
+    MediaSearchResult_t *result;
+    json_object *jquery = NULL;
+    gchar *error = NULL;
+    GString *out;
+    GBytes *jresp;
+    gint scan_types, limit, fields;
+    guint i;
+
+    if(!json_object_object_get_ex(afb_req_json(request),"query",&jquery) ||
+       !json_object_is_type(jquery,json_type_string)) {
+        afb_req_fail(request, "failed", "invalid query type");
+        return;
+    }
+    scan_types = LMS_ALL_SCAN;
+    if(json_object_object_get_ex(afb_req_json(request),"types",NULL)) {
+        scan_types = get_scan_types(request);
+        if(scan_types < 0)
+            return;
+    }
+    limit = get_scan_limit(request);
+    if(limit < 0)
+        return;
+    fields = get_scan_fields(request);
+    if(fields < 0)
+        return;
+
+    result = media_search(json_object_get_string(jquery), scan_types,
+                          limit ? limit : MEDIA_SEARCH_LIMIT, &error);
+    if (result == NULL) {
+        afb_req_fail(request, "failed", error);
+        g_free(error);
+        return;
+    }
+
+    out = g_string_sized_new(64 + result->hits->len * MEDIA_JSON_ITEM_SIZE);
+    g_string_append(out, "{\"Media\":[");
+    for (i = 0; i < result->hits->len; i++) {
+        const MediaSearchHit_t *hit = &g_array_index(result->hits, MediaSearchHit_t, i);
+
+        if (i)
+            g_string_append_c(out, ',');
+        media_json_append_item(out, &hit->item, lms_scan_types[hit->scan_type_id],
+                               fields);
+    }
+    g_string_append(out, "]}");
+    media_search_result_free(result);
+
+    jresp = g_string_free_to_bytes(out);
+    afb_req_success(request, json_object_new_serialized(jresp), "Search results");
+    g_bytes_unref(jresp);
+}
+
+/*
+ * Reply with the rows of 'view' as the array member 'key', on the
+ * "device" of the request or on every mounted device
+ */
+static void browse_reply(afb_req_t request, MediaBrowseView_t view,
+                         const gchar *key, const gchar *artist)
+{
+    MediaBrowseResult_t *result;
+    gchar *device = NULL;
+    gchar *error = NULL;
+    GString *out;
+    GBytes *jresp;
+    guint i;
+
+    if(get_scan_device(request, &device) < 0)
+        return;
+
+    result = media_browse(view, artist, device, &error);
+    g_free(device);
+    if (result == NULL) {
+        afb_req_fail(request, "failed", error);
+        g_free(error);
+        return;
+    }
+
+    out = g_string_sized_new(64 + result->rows->len * 64);
+    g_string_append_printf(out, "{\"%s\":[", key);
+    for (i = 0; i < result->rows->len; i++) {
+        const MediaBrowseRow_t *row = &g_array_index(result->rows, MediaBrowseRow_t, i);
+
+        g_string_append_printf(out, "%s{\"count\":%d,\"duration\":%" G_GINT64_FORMAT,
+                               i ? "," : "", row->count, row->duration);
+        json_append_member(out, "name", row->name);
+        json_append_member(out, "artist", row->artist);
+        g_string_append_c(out, '}');
+    }
+    g_string_append(out, "]}");
+    media_browse_result_free(result);
+
+    jresp = g_string_free_to_bytes(out);
+    afb_req_success(request, json_object_new_serialized(jresp), "Browse results");
+    g_bytes_unref(jresp);
+}
+
+static void artists (afb_req_t request)
+{
+    browse_reply(request, MEDIA_BROWSE_ARTISTS, "artists", NULL);
+}
+
+static void albums (afb_req_t request)
+{
+    const gchar *artist;
+
+    if(get_browse_name(request, "artist", FALSE, &artist) < 0)
+        return;
+
+    browse_reply(request, MEDIA_BROWSE_ALBUMS, "albums", artist);
+}
+
+static void genres (afb_req_t request)
+{
+    browse_reply(request, MEDIA_BROWSE_GENRES, "genres", NULL);
+}
+
+static void tracks (afb_req_t request)
+{
+    MediaBrowseResult_t *result;
+    const gchar *album, *artist;
+    gchar *device = NULL;
+    gchar *error = NULL;
+    GString *out;
+    GBytes *jresp;
+    gint fields;
+    guint i;
+
+    if(get_browse_name(request, "album", TRUE, &album) < 0 ||
+       get_browse_name(request, "artist", FALSE, &artist) < 0)
+        return;
+    fields = get_scan_fields(request);
+    if(fields < 0)
+        return;
+    if(get_scan_device(request, &device) < 0)
+        return;
+
+    result = media_browse_tracks(album, artist, device, fields, &error);
+    g_free(device);
+    if (result == NULL) {
+        afb_req_fail(request, "failed", error);
+        g_free(error);
+        return;
+    }
+
+    out = g_string_sized_new(64 + result->items->len * MEDIA_JSON_ITEM_SIZE);
+    g_string_append(out, "{\"Media\":[");
+    for (i = 0; i < result->items->len; i++) {
+        if (i)
+            g_string_append_c(out, ',');
+        media_json_append_item(out, &g_array_index(result->items, MediaItem_t, i),
+                               MEDIA_AUDIO, fields);
+    }
+    g_string_append(out, "]}");
+    media_browse_result_free(result);
+
+    jresp = g_string_free_to_bytes(out);
+    afb_req_success(request, json_object_new_serialized(jresp), "Browse results");
+    g_bytes_unref(jresp);
+}
+
+static void rescan_done(const gchar *error, gpointer data)
+{
+    afb_req_t request = data;
+
+    if (error)
+        afb_req_fail(request, "failed", error);
+    else
+        afb_req_success(request, NULL, "Rescan done");
+    afb_req_unref(request);
+}
+
+/* Reply once LMS is done scanning the path again */
+static void rescan (afb_req_t request)
+{
+    json_object *jtypes = NULL;
+    gchar *path = NULL;
+    gint scan_types = LMS_ALL_SCAN;
+
+    if(json_object_object_get_ex(afb_req_json(request),"types",&jtypes)) {
+        scan_types = get_scan_types(request);
+        if(scan_types < 0)
+            return;
+    }
+    if(get_rescan_path(request, &path) < 0)
+        return;
+
+    media_scan_request(path, scan_types, rescan_done, afb_req_addref(request));
+    g_free(path);
+}
+
 static const afb_verb_t binding_verbs[] = {
     { .verb = "media_result", .callback = media_results_get, .info = "Media scan result" },
     { .verb = "subscribe",    .callback = subscribe,         .info = "Subscribe for an event" },
     { .verb = "unsubscribe",  .callback = unsubscribe,       .info = "Unsubscribe for an event" },
+    { .verb = "stats",        .callback = stats,             .info = "Service statistics" },
+    { .verb = "devices",      .callback = devices,           .info = "Storage devices" },
+    { .verb = "summary",      .callback = summary,           .info = "Media counts per device" },
+    { .verb = "rescan",       .callback = rescan,            .info = "Scan a directory again" },
+    { .verb = "search",       .callback = search,            .info = "Search media" },
+    { .verb = "artists",      .callback = artists,           .info = "Audio artists" },
+    { .verb = "albums",       .callback = albums,            .info = "Audio albums" },
+    { .verb = "genres",       .callback = genres,            .info = "Audio genres" },
+    { .verb = "tracks",       .callback = tracks,            .info = "Tracks of an album" },
     { }
 };
 
+/*
+ * Apply the SQLite tuning given in the binder settings of this API:
+ * "sqlite_mmap_size", "sqlite_cache_size" and "sqlite_temp_store".
+ */
+static void set_db_settings(afb_api_t api)
+{
+    MediaDBSettings_t settings = {
+        .mmap_size = MEDIA_DB_MMAP_SIZE,
+        .cache_size = MEDIA_DB_CACHE_SIZE,
+        .temp_store = MEDIA_DB_TEMP_STORE,
+    };
+    json_object *jsettings = afb_api_settings(api);
+    json_object *jval = NULL;
+
+    if(json_object_object_get_ex(jsettings,"sqlite_mmap_size",&jval) &&
+       json_object_is_type(jval,json_type_int))
+        settings.mmap_size = json_object_get_int64(jval);
+    if(json_object_object_get_ex(jsettings,"sqlite_cache_size",&jval) &&
+       json_object_is_type(jval,json_type_int))
+        settings.cache_size = json_object_get_int(jval);
+    if(json_object_object_get_ex(jsettings,"sqlite_temp_store",&jval) &&
+       json_object_is_type(jval,json_type_int))
+        settings.temp_store = json_object_get_int(jval);
+
+    setAPIDatabaseSettings(&settings);
+}
+
+/* NULL terminated copy of the strings of 'jarray', NULL if it is not one */
+static gchar **get_string_array(json_object *jarray)
+{
+    gchar **strv;
+    size_t i, n;
+
+    if(!json_object_is_type(jarray,json_type_array))
+        return NULL;
+
+    n = json_object_array_length(jarray);
+    strv = g_new0(gchar *, n + 1);
+    for(i = 0; i < n; i++)
+        strv[i] = g_strdup(json_object_get_string(
+                               json_object_array_get_idx(jarray, i)));
+    return strv;
+}
+
+/*
+ * Apply the mount detection settings of the binder: "mount_roots", the
+ * directories devices get mounted below, and "mount_fstypes", the
+ * filesystems of removable media.
+ */
+static void set_mount_settings(afb_api_t api)
+{
+    json_object *jsettings = afb_api_settings(api);
+    json_object *jval = NULL;
+    gchar **roots = NULL, **fstypes = NULL;
+
+    if(json_object_object_get_ex(jsettings,"mount_roots",&jval))
+        roots = get_string_array(jval);
+    if(json_object_object_get_ex(jsettings,"mount_fstypes",&jval))
+        fstypes = get_string_array(jval);
+
+    setAPIMountSettings((const gchar * const *) roots,
+                        (const gchar * const *) fstypes);
+    g_strfreev(roots);
+    g_strfreev(fstypes);
+}
+
+/* Apply the "search_index" setting, the file of the search index */
+static void set_search_settings(afb_api_t api)
+{
+    json_object *jval = NULL;
+
+    if(json_object_object_get_ex(afb_api_settings(api),"search_index",&jval) &&
+       json_object_is_type(jval,json_type_string))
+        setAPISearchIndex(json_object_get_string(jval));
+}
+
 static int init(afb_api_t api)
 {
     Binding_RegisterCallback_t API_Callback;
     API_Callback.binding_device_added = media_broadcast_device_added;
     API_Callback.binding_device_removed = media_broadcast_device_removed;
+    API_Callback.binding_device_progress = media_broadcast_device_progress;
+    API_Callback.binding_device_changed = media_broadcast_device_changed;
     BindingAPIRegister(&API_Callback);
 
+
     media_added_event = afb_daemon_make_event("media_added");
+    /* Another event of the same name, for the sessions that get chunks */
+    media_added_chunked_event = afb_daemon_make_event("media_added");
     media_removed_event = afb_daemon_make_event("media_removed");
 
+    /* Without workers, media_result is answered on the calling thread */
+    g_mutex_init(&workers.m);
+    workers.pool = g_thread_pool_new(media_results_worker, NULL,
+                                     MEDIA_WORKER_THREADS, FALSE, NULL);
+    if (workers.pool == NULL)
+        LOGE("Cannot start the media_result workers\n");
+
+    set_db_settings(api);
+    set_mount_settings(api);
+    set_search_settings(api);
+
     return MediaPlayerManagerInit();
 }
 
@@ -0,0 +1,135 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Response cache
+ *
+ * Serialized replies are kept by request parameters and LMS UpdateID, so
+ * that repeating a request between two LMS scans only costs copying the
+ * reply out. The cache is flushed whenever the data behind a reply may
+ * have changed. Every flush bumps a generation counter: a reply computed
+ * across a flush is not inserted, so it cannot outlive the flush.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+typedef struct {
+    GMutex m;
+    GHashTable *entries;    /* key -> GBytes */
+    gsize size;             /* bytes held by the entries */
+    guint generation;
+} MediaCache_t;
+
+static MediaCache_t cache = { 0 };
+
+static void media_cache_key_text(GString *key, const gchar *text)
+{
+    if (text)
+        g_string_append_printf(key, ":%" G_GSIZE_FORMAT "=%s", strlen(text), text);
+    else
+        g_string_append(key, ":-");
+}
+
+/*
+ * Key of the reply to a scan with 'filter'. The cursor is encoded again,
+ * so that equivalent cursors share one entry.
+ */
+gchar *media_cache_key(const ScanFilter_t *filter)
+{
+    gchar *cursor = filter->cursor ? media_cursor_encode(filter->cursor) : NULL;
+    GString *key = g_string_new(NULL);
+
+    g_string_append_printf(key, "%" G_GUINT64_FORMAT ":%d:%d:%d:%s:%s",
+                           media_lms_update_id(), filter->scan_types,
+                           filter->listview_type, filter->limit,
+                           filter->scan_uri ? filter->scan_uri : "",
+                           cursor ? cursor : "");
+    g_free(cursor);
+    g_string_append_printf(key, ":%d", filter->fields);
+
+    /* Lengths keep values with separators in them apart */
+    if (filter->match) {
+        media_cache_key_text(key, filter->match->artist);
+        media_cache_key_text(key, filter->match->album);
+        media_cache_key_text(key, filter->match->genre);
+        media_cache_key_text(key, filter->match->title);
+        g_string_append_printf(key, ":%d:%d", filter->match->min_duration,
+                               filter->match->max_duration);
+    }
+    return g_string_free(key, FALSE);
+}
+
+/*
+ * Return a new reference on the reply cached for 'key', or NULL. The
+ * current generation is stored in 'generation' for a later insertion.
+ */
+GBytes *media_cache_lookup(const gchar *key, guint *generation)
+{
+    GBytes *bytes;
+
+    g_mutex_lock(&cache.m);
+    bytes = g_hash_table_lookup(cache.entries, key);
+    if (bytes)
+        g_bytes_ref(bytes);
+    *generation = cache.generation;
+    g_mutex_unlock(&cache.m);
+
+    return bytes;
+}
+
+/*
+ * Cache 'bytes' for 'key' unless the cache was flushed since 'generation'
+ * was looked up. The cache is emptied when it would exceed its budget.
+ */
+void media_cache_insert(const gchar *key, guint generation, GBytes *bytes)
+{
+    const gsize size = g_bytes_get_size(bytes);
+
+    if (size > MEDIA_CACHE_MAX_SIZE / 4)
+        return;
+
+    g_mutex_lock(&cache.m);
+    if (generation == cache.generation &&
+        !g_hash_table_contains(cache.entries, key)) {
+        if (cache.size + size > MEDIA_CACHE_MAX_SIZE) {
+            g_hash_table_remove_all(cache.entries);
+            cache.size = 0;
+        }
+        g_hash_table_insert(cache.entries, g_strdup(key), g_bytes_ref(bytes));
+        cache.size += size;
+    }
+    g_mutex_unlock(&cache.m);
+}
+
+void media_cache_invalidate(void)
+{
+    g_mutex_lock(&cache.m);
+    g_hash_table_remove_all(cache.entries);
+    cache.size = 0;
+    cache.generation++;
+    g_mutex_unlock(&cache.m);
+}
+
+void media_cache_init(void)
+{
+    g_mutex_init(&cache.m);
+    cache.entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) g_bytes_unref);
+}
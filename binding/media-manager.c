@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -38,167 +39,1667 @@ const gchar *lms_scan_types[] = {
     MEDIA_VIDEO,
     MEDIA_IMAGE
 };
+/*
+ * Read-only connections to the LMS database, each used by one thread at
+ * a time. Released connections are kept for reuse. Closing the pool only
+ * closes idle connections: the ones in use are closed when released, so
+ * a device removal never pulls a connection from under a running query.
+ */
 typedef struct {
     sqlite3 *db;
-    gboolean is_open;
+    GHashTable *stmts;  /* SQL text -> persistent sqlite3_stmt */
+    guint epoch;        /* pool epoch the connection was opened in */
+} MediaDBConn_t;
+
+typedef struct {
+    GMutex m;
+    GQueue idle;        /* MediaDBConn_t ready for reuse */
+    guint epoch;        /* bumped whenever the pool is closed */
+    gboolean busy;      /* a read found LMS writing since the last refresh */
+    MediaDBSettings_t settings;
 }scannerDB;
 
-static Binding_RegisterCallback_t g_RegisterCallback = { 0 };
-static stMediaPlayerManage MediaPlayerManage = { 0 };
-static scannerDB scanDB = { 0 };
+/*
+ * Per-category query, the same leaving its media columns and conditions
+ * to fill in (see media_sql_columns()) with the columns they are read
+ * from and the conditions of a filter, sort key length, and the queries
+ * of the media added during a scan and of a summary
+ */
+static const struct {
+    const gchar *query;
+    const gchar *format;
+    const gchar *columns[5];    /* title, artist, album, genre, length */
+    const gchar *match;
+    gint n_keys;
+    const gchar *progress;
+    const gchar *summary;
+    const gchar *stream;
+    const gchar *changed;
+    const gchar *files;
+} lms_queries[LMS_SCAN_COUNT] = {
+    [LMS_AUDIO_ID] = { AUDIO_SQL_QUERY,
+                       AUDIO_SQL_QUERY_COLUMNS("%s", "%s", "%s", "%s", "%s", "%s"),
+                       { "audios.title", "audio_artists.name", "audio_albums.name",
+                         "audio_genres.name", "audios.length" },
+                       AUDIO_SQL_MATCH, 4, AUDIO_SQL_PROGRESS,
+                       AUDIO_SQL_SUMMARY, AUDIO_SQL_STREAM,
+                       AUDIO_SQL_CHANGED, AUDIO_SQL_FILES },
+    [LMS_VIDEO_ID] = { VIDEO_SQL_QUERY,
+                       VIDEO_SQL_QUERY_COLUMNS("%s", "%s", "%s", "%s", "%s", "%s"),
+                       { "videos.title", "videos.artist", "\"\"", "\"\"",
+                         "videos.length" },
+                       VIDEO_SQL_MATCH, 2, VIDEO_SQL_PROGRESS,
+                       VIDEO_SQL_SUMMARY, VIDEO_SQL_STREAM,
+                       VIDEO_SQL_CHANGED, VIDEO_SQL_FILES },
+    [LMS_IMAGE_ID] = { IMAGE_SQL_QUERY,
+                       IMAGE_SQL_QUERY_COLUMNS("%s", "%s", "%s", "%s", "%s", "%s"),
+                       { "images.title", "\"\"", "\"\"", "\"\"", "0" },
+                       IMAGE_SQL_MATCH, 2, IMAGE_SQL_PROGRESS,
+                       IMAGE_SQL_SUMMARY, IMAGE_SQL_STREAM,
+                       IMAGE_SQL_CHANGED, IMAGE_SQL_FILES },
+};
+
+static Binding_RegisterCallback_t g_RegisterCallback = { 0 };
+static stMediaPlayerManage MediaPlayerManage = { 0 };
+static scannerDB scanDB = {
+    .settings = {
+        .mmap_size = MEDIA_DB_MMAP_SIZE,
+        .cache_size = MEDIA_DB_CACHE_SIZE,
+        .temp_store = MEDIA_DB_TEMP_STORE,
+    },
+};
+
+/* ------ LOCAL  FUNCTIONS --------- */
+
+void ListLock() {
+    g_mutex_lock(&(MediaPlayerManage.m));
+}
+
+void ListUnlock() {
+    g_mutex_unlock(&(MediaPlayerManage.m));
+}
+
+void DebugTraceSendMsg(int level, gchar* message)
+{
+#ifdef LOCAL_PRINT_DEBUG
+    switch (level)
+    {
+            case DT_LEVEL_ERROR:
+                g_print("[E]");
+                break;
+
+            case DT_LEVEL_WARNING:
+                g_print("[W]");
+                break;
+
+            case DT_LEVEL_NOTICE:
+                g_print("[N]");
+                break;
+
+            case DT_LEVEL_INFO:
+                g_print("[I]");
+                break;
+
+            case DT_LEVEL_DEBUG:
+                g_print("[D]");
+                break;
+
+            default:
+                g_print("[-]");
+                break;
+    }
+
+    g_print("%s",message);
+#endif
+
+    if (message) {
+        g_free(message);
+    }
+
+}
+
+static const gchar *arena_insert(GStringChunk *arena, const unsigned char *str)
+{
+    return str ? g_string_chunk_insert(arena, (const gchar *) str) : NULL;
+}
+
+/*
+ * Artist, album and genre names repeat across many tracks, so they are
+ * deduplicated inside the arena instead of being copied for every row.
+ */
+static const gchar *arena_insert_const(GStringChunk *arena, const unsigned char *str)
+{
+    return str ? g_string_chunk_insert_const(arena, (const gchar *) str) : NULL;
+}
+
+static void media_cursor_clear(MediaCursor_t *cursor)
+{
+    gint i;
+
+    for (i = 0; i < cursor->n_keys; i++) {
+        g_free(cursor->keys[i].text);
+        cursor->keys[i].text = NULL;
+    }
+    cursor->n_keys = 0;
+}
+
+/* Remember the sort key of the current row of 'res' */
+static void media_cursor_set_row(MediaCursor_t *cursor, sqlite3_stmt *res, gint n_keys)
+{
+    gint i;
+
+    media_cursor_clear(cursor);
+    for (i = 0; i < n_keys; i++) {
+        const gint col = MEDIA_SQL_KEY_COLUMN + i;
+
+        cursor->keys[i].is_text = sqlite3_column_type(res, col) == SQLITE_TEXT;
+        if (cursor->keys[i].is_text)
+            cursor->keys[i].text = g_strdup((const gchar *) sqlite3_column_text(res, col));
+        else
+            cursor->keys[i].num = sqlite3_column_int64(res, col);
+    }
+    cursor->n_keys = n_keys;
+}
+
+static void media_cursor_copy(MediaCursor_t *dst, const MediaCursor_t *src)
+{
+    gint i;
+
+    media_cursor_clear(dst);
+    dst->scan_type_id = src->scan_type_id;
+    for (i = 0; i < src->n_keys; i++) {
+        dst->keys[i].is_text = src->keys[i].is_text;
+        dst->keys[i].num = src->keys[i].num;
+        dst->keys[i].text = g_strdup(src->keys[i].text);
+    }
+    dst->n_keys = src->n_keys;
+}
+
+/*
+ * Bind the keyset predicate parameters. A NULL or empty cursor binds the
+ * smallest integer, which SQLite sorts before any integer or text key,
+ * so the scan starts at the beginning of the category.
+ */
+static void media_cursor_bind(const MediaCursor_t *cursor, sqlite3_stmt *res, gint n_keys)
+{
+    gchar name[8];
+    gint i, idx;
+
+    for (i = 0; i < n_keys; i++) {
+        g_snprintf(name, sizeof(name), ":k%d", i);
+        idx = sqlite3_bind_parameter_index(res, name);
+        if (cursor && i < cursor->n_keys && cursor->keys[i].is_text)
+            sqlite3_bind_text(res, idx, cursor->keys[i].text, -1, SQLITE_TRANSIENT);
+        else if (cursor && i < cursor->n_keys)
+            sqlite3_bind_int64(res, idx, cursor->keys[i].num);
+        else
+            sqlite3_bind_int64(res, idx, G_MININT64);
+    }
+}
+
+static void media_db_conn_close(MediaDBConn_t *conn)
+{
+    g_hash_table_destroy(conn->stmts);
+    /* Defers the close instead of failing with SQLITE_BUSY if needed */
+    if (sqlite3_close_v2(conn->db) != SQLITE_OK)
+        LOGE("Failed to release SQLite connection handle.\n");
+    g_free(conn);
+}
+
+static MediaDBConn_t *media_db_conn_open(guint epoch,
+                                         const MediaDBSettings_t *settings,
+                                         gchar **error)
+{
+    const gchar *db_path;
+    MediaDBConn_t *conn;
+    gchar *pragmas;
+    int ret;
+
+    db_path = scanner1_get_data_base_path(MediaPlayerManage.lms_proxy);
+
+    conn = g_malloc0(sizeof(*conn));
+    ret = sqlite3_open_v2(db_path, &conn->db,
+                          SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (ret != SQLITE_OK) {
+        LOGD("Cannot open SQLITE database: '%s'\n", db_path);
+        *error = g_strdup_printf("Cannot open SQLITE database: '%s'", db_path);
+        sqlite3_close(conn->db);
+        g_free(conn);
+        return NULL;
+    }
+
+    pragmas = g_strdup_printf("PRAGMA mmap_size=%" G_GINT64_FORMAT ";"
+                              "PRAGMA cache_size=%d;"
+                              "PRAGMA temp_store=%d;",
+                              settings->mmap_size, settings->cache_size,
+                              settings->temp_store);
+    if (sqlite3_exec(conn->db, pragmas, NULL, NULL, NULL) != SQLITE_OK)
+        LOGE("Cannot tune SQLite connection: %s\n", sqlite3_errmsg(conn->db));
+    g_free(pragmas);
+
+    conn->stmts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) sqlite3_finalize);
+    conn->epoch = epoch;
+    return conn;
+}
+
+/*
+ * Take an idle connection, or open a new one. Reads wait a bounded time
+ * for LMS to release its write lock, but once one of them gave up, the
+ * next ones fail right away until the next refresh: LMS is then likely
+ * to hold its lock for a whole scan, and every request would wait.
+ */
+static MediaDBConn_t *media_db_acquire(gchar **error)
+{
+    MediaDBSettings_t settings;
+    MediaDBConn_t *conn;
+    gboolean busy;
+    guint epoch;
+
+    g_mutex_lock(&scanDB.m);
+    conn = g_queue_pop_head(&scanDB.idle);
+    epoch = scanDB.epoch;
+    busy = scanDB.busy;
+    settings = scanDB.settings;
+    g_mutex_unlock(&scanDB.m);
+
+    if (!conn)
+        conn = media_db_conn_open(epoch, &settings, error);
+    if (conn)
+        sqlite3_busy_timeout(conn->db, busy ? 0 : MEDIA_DB_BUSY_TIMEOUT);
+    return conn;
+}
+
+/* Set *error for a read that failed with 'ret' */
+static void media_db_read_failed(int ret, gchar **error)
+{
+    if (ret == SQLITE_BUSY) {
+        g_mutex_lock(&scanDB.m);
+        if (!scanDB.busy)
+            LOGD("LMS is writing, reads stop waiting until it is done\n");
+        scanDB.busy = TRUE;
+        g_mutex_unlock(&scanDB.m);
+    }
+    *error = g_strdup(ret == SQLITE_BUSY ? "Database busy" :
+                                           "Cannot execute query");
+}
+
+static void media_db_busy_reset(void)
+{
+    g_mutex_lock(&scanDB.m);
+    scanDB.busy = FALSE;
+    g_mutex_unlock(&scanDB.m);
+}
+
+/* Start the read transaction the reads of one reply share */
+static gint media_db_begin(MediaDBConn_t *conn, gchar **error)
+{
+    if (sqlite3_exec(conn->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+        LOGE("Cannot start a read transaction: %s\n", sqlite3_errmsg(conn->db));
+        *error = g_strdup("Cannot execute query");
+        return -1;
+    }
+    return 0;
+}
+
+/* End the read transaction of 'conn', whatever the reads gave */
+static void media_db_end(MediaDBConn_t *conn)
+{
+    if (sqlite3_exec(conn->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        LOGE("Cannot end a read transaction: %s\n", sqlite3_errmsg(conn->db));
+        sqlite3_exec(conn->db, "ROLLBACK", NULL, NULL, NULL);
+    }
+}
+
+/*
+ * Give 'conn' back for reuse, or close it if the pool was closed since
+ * it was opened or already has enough idle connections. Statements must
+ * have been reset.
+ */
+static void media_db_release(MediaDBConn_t *conn)
+{
+    gboolean reuse = sqlite3_get_autocommit(conn->db);
+
+    /* A connection left in a transaction would fail its next BEGIN */
+    g_mutex_lock(&scanDB.m);
+    if (reuse && conn->epoch == scanDB.epoch &&
+        g_queue_get_length(&scanDB.idle) < MEDIA_DB_POOL_SIZE) {
+        g_queue_push_head(&scanDB.idle, conn);
+        conn = NULL;
+    }
+    g_mutex_unlock(&scanDB.m);
+
+    if (conn)
+        media_db_conn_close(conn);
+}
+
+/* Close every connection, the ones in use as soon as they are released */
+static void media_db_close_all(void)
+{
+    GQueue idle = G_QUEUE_INIT;
+    MediaDBConn_t *conn;
+
+    g_mutex_lock(&scanDB.m);
+    idle = scanDB.idle;
+    g_queue_init(&scanDB.idle);
+    scanDB.epoch++;
+    g_mutex_unlock(&scanDB.m);
+
+    while ((conn = g_queue_pop_head(&idle)))
+        media_db_conn_close(conn);
+}
+
+/*
+ * Return the cached prepared statement of 'conn' for 'sql', preparing it
+ * on first use. Statements stay valid until the connection is closed;
+ * callers reset them and clear their bindings when done.
+ */
+static sqlite3_stmt *media_db_statement(MediaDBConn_t *conn, const gchar *sql,
+                                        gchar **error)
+{
+    sqlite3_stmt *res;
+    int ret;
+
+    res = g_hash_table_lookup(conn->stmts, sql);
+    if(res)
+        return res;
+
+    ret = sqlite3_prepare_v3(conn->db, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                             &res, NULL);
+    if (ret != SQLITE_OK) {
+        LOGE("Cannot prepare query: %s\n", sqlite3_errmsg(conn->db));
+        *error = g_strdup("Cannot execute query");
+        return NULL;
+    }
+
+    g_hash_table_insert(conn->stmts, g_strdup(sql), res);
+    return res;
+}
+
+/*
+ * Bind the [:prefix, :prefix_end) range matching every path below 'uri'.
+ * LMS stores paths as BLOBs, so the bounds are bound as BLOBs as well to
+ * compare bytewise against the files.path index. The upper bound is the
+ * prefix with its trailing '/' bumped to the next byte value, '0'.
+ */
+static void media_db_bind_prefix(sqlite3_stmt *res, const gchar *uri)
+{
+    gchar *prefix = g_strconcat(uri ? uri : "", "/", NULL);
+    gchar *prefix_end = g_strdup(prefix);
+    const gsize len = strlen(prefix);
+
+    prefix_end[len - 1]++;
+    sqlite3_bind_blob(res, sqlite3_bind_parameter_index(res, ":prefix"),
+                      prefix, len, g_free);
+    sqlite3_bind_blob(res, sqlite3_bind_parameter_index(res, ":prefix_end"),
+                      prefix_end, len, g_free);
+}
+
+/* Whether LMS is writing to its database */
+static gboolean media_lms_write_locked(void)
+{
+    if (MediaPlayerManage.lms_proxy == NULL)
+        return FALSE;
+    return scanner1_get_write_locked(MediaPlayerManage.lms_proxy);
+}
+
+/* The file:// URI of 'path', escaped the way media items are */
+static gchar *media_path_to_uri(const gchar *path)
+{
+    GString *uri = g_string_new("file://");
+
+    g_string_append_uri_escaped(uri, path, "/", TRUE);
+    return g_string_free(uri, FALSE);
+}
+
+/* Fill 'item' from the six media columns of the current row of 'res' */
+static void media_item_set_row(MediaItem_t *item, sqlite3_stmt *res,
+                               GStringChunk *arena, GString *uri_buf)
+{
+    g_string_assign(uri_buf, "file://");
+    g_string_append_uri_escaped(uri_buf, (const char *) sqlite3_column_text(res, 0),
+                                "/", TRUE);
+    item->path = g_string_chunk_insert_len(arena, uri_buf->str, uri_buf->len);
+
+    item->metadata.title = arena_insert(arena, sqlite3_column_text(res, 1));
+    item->metadata.artist = arena_insert_const(arena, sqlite3_column_text(res, 2));
+    item->metadata.album = arena_insert_const(arena, sqlite3_column_text(res, 3));
+    item->metadata.genre = arena_insert_const(arena, sqlite3_column_text(res, 4));
+    item->metadata.duration = sqlite3_column_int(res, 5) * 1000;
+}
+
+/* Bind 'value' to the parameter 'name' if 'res' has one, NULL when unset */
+static void media_db_bind_text(sqlite3_stmt *res, const gchar *name,
+                               const gchar *value)
+{
+    const int idx = sqlite3_bind_parameter_index(res, name);
+
+    if (idx && value)
+        sqlite3_bind_text(res, idx, value, -1, SQLITE_TRANSIENT);
+}
+
+/*
+ * Media columns to select: the 'columns' of the MEDIA_FIELD_* in
+ * 'fields', NULL for the others, or 0 for the length
+ */
+static void media_sql_columns(const gchar * const *columns, gint fields,
+                              const gchar **selected)
+{
+    selected[0] = fields & MEDIA_FIELD_TITLE ? columns[0] : "NULL";
+    selected[1] = fields & MEDIA_FIELD_ARTIST ? columns[1] : "NULL";
+    selected[2] = fields & MEDIA_FIELD_ALBUM ? columns[2] : "NULL";
+    selected[3] = fields & MEDIA_FIELD_GENRE ? columns[3] : "NULL";
+    selected[4] = fields & MEDIA_FIELD_DURATION ? columns[4] : "0";
+}
+
+/* Bind the conditions of 'match' to the *_SQL_MATCH parameters */
+static void media_match_bind(sqlite3_stmt *res, const MediaMatch_t *match)
+{
+    const gchar *c;
+    GString *pattern;
+
+    media_db_bind_text(res, ":artist", match->artist);
+    media_db_bind_text(res, ":album", match->album);
+    media_db_bind_text(res, ":genre", match->genre);
+
+    /* Title prefix as a LIKE pattern, its wildcards escaped */
+    if (match->title) {
+        pattern = g_string_new(NULL);
+        for (c = match->title; *c; c++) {
+            if (*c == '%' || *c == '_' || *c == '\\')
+                g_string_append_c(pattern, '\\');
+            g_string_append_c(pattern, *c);
+        }
+        g_string_append_c(pattern, '%');
+        media_db_bind_text(res, ":title", pattern->str);
+        g_string_free(pattern, TRUE);
+    }
+
+    if (match->min_duration >= 0)
+        sqlite3_bind_int64(res, sqlite3_bind_parameter_index(res, ":min_duration"),
+                           match->min_duration);
+    if (match->max_duration >= 0)
+        sqlite3_bind_int64(res, sqlite3_bind_parameter_index(res, ":max_duration"),
+                           match->max_duration);
+}
+
+/* Rows read between two clears of the media_catalogue_foreach() arena */
+#define MEDIA_CATALOGUE_BATCH 256
+
+/* Number of media of the catalogue in category 'id', or -1 */
+static gint media_catalogue_count(MediaDBConn_t *conn, gint id, gchar **error)
+{
+    sqlite3_stmt *res = media_db_statement(conn, lms_queries[id].summary, error);
+    gint count = -1;
+    int ret;
+
+    if (!res)
+        return -1;
+
+    media_db_bind_prefix(res, SCAN_URI_DEFAULT);
+    ret = sqlite3_step(res);
+    if (ret == SQLITE_ROW) {
+        count = sqlite3_column_int(res, 0);
+    } else {
+        LOGE("Cannot count %s media: %s\n", lms_scan_types[id],
+             sqlite3_errstr(ret));
+        media_db_read_failed(ret, error);
+    }
+    sqlite3_reset(res);
+    sqlite3_clear_bindings(res);
+
+    return count;
+}
+
+/*
+ * Call 'func' on the media of the catalogue LMS wrote after the UpdateID
+ * 'since', category by category, as the rows are read: item strings are
+ * only valid during the call. A negative 'since', or one past the
+ * UpdateID of LMS, as after LMS created its database anew, covers the
+ * whole catalogue.
+ *
+ * All of them are read in one read transaction. 'update_id' gets the
+ * UpdateID the media read are complete up to: one less than the UpdateID
+ * of LMS while it is writing, as more rows may come with the current
+ * one, and 'since' while the UpdateID is unknown. 'count' gets the number
+ * of media of the catalogue. Returns -1 if the catalogue could not be
+ * read through.
+ */
+gint media_catalogue_foreach(MediaEntryFunc func, gpointer data, gint64 since,
+                             gint64 *update_id, gint *count, gchar **error)
+{
+    GStringChunk *arena;
+    MediaDBConn_t *conn;
+    GString *uri_buf;
+    sqlite3_stmt *res;
+    gint64 current;
+    gint rows = 0;
+    gint num;
+    gint id;
+    int ret = SQLITE_DONE;
+
+    conn = media_db_acquire(error);
+    if (!conn)
+        return -1;
+
+    if (media_db_begin(conn, error) < 0) {
+        media_db_release(conn);
+        return -1;
+    }
+
+    arena = g_string_chunk_new(MEDIA_ARENA_CHUNK_SIZE);
+    uri_buf = g_string_sized_new(PATH_MAX);
+    current = media_lms_update_id();
+    if (current > 0 && current < since)
+        since = -1;
+    if (current == 0)
+        *update_id = since;
+    else
+        *update_id = media_lms_write_locked() ? current - 1 : current;
+    *count = 0;
+
+    for (id = LMS_MIN_ID; ret == SQLITE_DONE && id < LMS_SCAN_COUNT; ++id) {
+        num = media_catalogue_count(conn, id, error);
+        if (num < 0) {
+            ret = SQLITE_ERROR;
+            break;
+        }
+        *count += num;
+
+        res = media_db_statement(conn, lms_queries[id].changed, error);
+        if (!res) {
+            ret = SQLITE_ERROR;
+            break;
+        }
+
+        media_db_bind_prefix(res, SCAN_URI_DEFAULT);
+        sqlite3_bind_int64(res, sqlite3_bind_parameter_index(res, ":since"), since);
+
+        while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+            MediaItem_t item;
+
+            if (rows++ % MEDIA_CATALOGUE_BATCH == 0)
+                g_string_chunk_clear(arena);
+            media_item_set_row(&item, res, arena, uri_buf);
+            func(id, (const gchar *) sqlite3_column_text(res, 0), &item, data);
+        }
+        sqlite3_reset(res);
+        sqlite3_clear_bindings(res);
+
+        if (ret != SQLITE_DONE) {
+            LOGE("Cannot read %s media: %s\n", lms_scan_types[id],
+                 sqlite3_errstr(ret));
+            media_db_read_failed(ret, error);
+        }
+    }
+    media_db_end(conn);
+    media_db_release(conn);
+    g_string_free(uri_buf, TRUE);
+    g_string_chunk_free(arena);
+
+    return ret == SQLITE_DONE ? 0 : -1;
+}
+
+/*
+ * Call 'func' with the path of every media of the catalogue, in one read
+ * transaction. Returns -1 if the catalogue could not be read through.
+ */
+gint media_catalogue_files(MediaFileFunc func, gpointer data, gchar **error)
+{
+    MediaDBConn_t *conn;
+    sqlite3_stmt *res;
+    gint id;
+    int ret = SQLITE_DONE;
+
+    conn = media_db_acquire(error);
+    if (!conn)
+        return -1;
+
+    if (media_db_begin(conn, error) < 0) {
+        media_db_release(conn);
+        return -1;
+    }
+
+    for (id = LMS_MIN_ID; ret == SQLITE_DONE && id < LMS_SCAN_COUNT; ++id) {
+        res = media_db_statement(conn, lms_queries[id].files, error);
+        if (!res) {
+            ret = SQLITE_ERROR;
+            break;
+        }
+
+        media_db_bind_prefix(res, SCAN_URI_DEFAULT);
+        while ((ret = sqlite3_step(res)) == SQLITE_ROW)
+            func((const gchar *) sqlite3_column_text(res, 0), data);
+        sqlite3_reset(res);
+        sqlite3_clear_bindings(res);
+
+        if (ret != SQLITE_DONE) {
+            LOGE("Cannot read %s files: %s\n", lms_scan_types[id],
+                 sqlite3_errstr(ret));
+            media_db_read_failed(ret, error);
+        }
+    }
+    media_db_end(conn);
+    media_db_release(conn);
+
+    return ret == SQLITE_DONE ? 0 : -1;
+}
+
+static gboolean media_path_is_below(const gchar *path, const gchar *root)
+{
+    const gsize len = strlen(root);
+
+    return strncmp(path, root, len) == 0 && path[len] == '/';
+}
+
+/* Whether 'path' or one of its parent directories is in 'paths' */
+static gboolean media_path_is_in(const gchar *path, GHashTable *paths)
+{
+    gchar *dir = g_strdup(path);
+    gchar *slash;
+    gboolean found = g_hash_table_contains(paths, dir);
+
+    while (!found && (slash = strrchr(dir, '/')) && slash != dir) {
+        *slash = '\0';
+        found = g_hash_table_contains(paths, dir);
+    }
+    g_free(dir);
+
+    return found;
+}
+
+/*
+ * Append the items of mlist's category to mlist, starting after 'after'
+ * (or at the start of the category when NULL). With limit >= 0 at most
+ * 'limit' items are appended and, if more remain, mdev->next_cursor is
+ * set to resume right after the last appended one. A negative limit
+ * scans the whole category. Rows are read on 'conn', in the read
+ * transaction of the caller.
+ */
+gint media_lightmediascanner_scan(MediaDevice_t *mdev, MediaDBConn_t *conn,
+                                  MediaList_t *mlist, const MediaCursor_t *after,
+                                  gint limit, gchar **error)
+{
+    const gint id = mlist->scan_type_id;
+    const gint n_keys = lms_queries[id].n_keys;
+    const ScanFilter_t *filters = mdev->filters;
+    const gboolean paginate = limit >= 0;
+    MediaCursor_t resume = { 0 };   /* last row read from the DB */
+    MediaCursor_t last = { 0 };     /* last row appended to mlist */
+    sqlite3_stmt *res;
+    GString *uri_buf;
+    gboolean more = FALSE;
+    gint batch, fetched;
+    const gchar *columns[5];
+    gint num = 0;
+    gchar *sql;
+    int ret;
+
+    media_sql_columns(lms_queries[id].columns,
+                      filters->fields ? filters->fields : MEDIA_FIELD_ALL, columns);
+    sql = g_strdup_printf(lms_queries[id].format, columns[0], columns[1],
+                          columns[2], columns[3], columns[4],
+                          filters->match ? lms_queries[id].match : "");
+    res = media_db_statement(conn, sql, error);
+    g_free(sql);
+    if (!res)
+        return -1;
+
+    media_db_bind_prefix(res, filters->scan_uri);
+    if (filters->match)
+        media_match_bind(res, filters->match);
+
+    /* Scratch buffer for the escaped URI, reused for every row */
+    uri_buf = g_string_sized_new(PATH_MAX);
+
+    if (paginate && after)
+        media_cursor_copy(&resume, after);
+
+    do {
+        /*
+         * Fetch one row more than needed to learn whether the category
+         * continues past this page. Rows filtered out here, such as the
+         * ones of files known to be gone, shorten the batch, in which case
+         * the query is resumed after the last row read.
+         */
+        batch = paginate ? limit - num + 1 : -1;
+        fetched = 0;
+        media_cursor_bind(paginate ? &resume : NULL, res, n_keys);
+        sqlite3_bind_int(res, sqlite3_bind_parameter_index(res, ":limit"), batch);
+
+        while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+            const char *path = (const char *) sqlite3_column_text(res, 0);
+            MediaItem_t item;
+
+            fetched++;
+            if (paginate)
+                media_cursor_set_row(&resume, res, n_keys);
+
+            if (filters->scan_paths && !media_path_is_in(path, filters->scan_paths))
+                continue;
+            if (!media_validator_is_valid(path))
+                continue;
+
+            if (paginate && num == limit) {
+                more = TRUE;
+                break;
+            }
+
+            media_item_set_row(&item, res, mdev->arena, uri_buf);
+            g_array_append_val(mlist->items, item);
+            num++;
+
+            if (paginate)
+                media_cursor_copy(&last, &resume);
+        }
+        sqlite3_reset(res);
+    } while (paginate && !more && ret == SQLITE_DONE && fetched == batch);
+
+    sqlite3_clear_bindings(res);
+    g_string_free(uri_buf, TRUE);
+    media_cursor_clear(&resume);
+
+    if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+        LOGE("Cannot read %s media: %s\n", lms_scan_types[id],
+             sqlite3_errstr(ret));
+        media_db_read_failed(ret, error);
+        media_cursor_clear(&last);
+        return -1;
+    }
+
+    if (more) {
+        mdev->next_cursor = g_malloc0(sizeof(MediaCursor_t));
+        if (num == 0 && after)
+            media_cursor_copy(mdev->next_cursor, after);
+        else
+            media_cursor_copy(mdev->next_cursor, &last);
+        mdev->next_cursor->scan_type_id = id;
+    }
+    media_cursor_clear(&last);
+
+    return num;
+}
+
+/*
+ * Library browsing
+ *
+ * Only the tracks on mounted devices are browsed: a view is a few rows
+ * SQLite aggregates over the files.path range of each device, merged
+ * here, and tracks are read device by device, leaving out the files
+ * known to be gone.
+ */
+static const gchar *browse_queries[MEDIA_BROWSE_COUNT] = {
+    [MEDIA_BROWSE_ARTISTS] = BROWSE_SQL_ARTISTS,
+    [MEDIA_BROWSE_ALBUMS]  = BROWSE_SQL_ALBUMS,
+    [MEDIA_BROWSE_GENRES]  = BROWSE_SQL_GENRES,
+};
+
+static void media_browse_add_device(const MediaMount_t *mount, gpointer data)
+{
+    if (mount->state != MEDIA_MOUNT_REMOVED)
+        g_ptr_array_add(data, g_strdup(mount->path));
+}
+
+static gint media_browse_device_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Names as SQLite's NOCASE collation orders them, NULL first */
+static gint media_browse_row_cmp(gconstpointer a, gconstpointer b)
+{
+    const MediaBrowseRow_t *ra = a, *rb = b;
+
+    if (!ra->name || !rb->name)
+        return (ra->name != NULL) - (rb->name != NULL);
+    return g_ascii_strcasecmp(ra->name, rb->name);
+}
+
+/* Add the rows of 'res' to the rows of 'result', merged by 'ids' */
+static int media_browse_read_rows(MediaBrowseResult_t *result,
+                                  sqlite3_stmt *res, GHashTable *ids)
+{
+    int ret;
+
+    while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+        MediaBrowseRow_t row;
+        gpointer index;
+        gint64 *id;
+
+        row.id = sqlite3_column_int64(res, 4);
+        row.count = sqlite3_column_int(res, 2);
+        row.duration = sqlite3_column_int64(res, 3) * 1000;
+
+        if (g_hash_table_lookup_extended(ids, &row.id, NULL, &index)) {
+            MediaBrowseRow_t *other = &g_array_index(result->rows, MediaBrowseRow_t,
+                                                     GPOINTER_TO_UINT(index));
+
+            other->count += row.count;
+            other->duration += row.duration;
+            continue;
+        }
+
+        row.name = arena_insert_const(result->arena, sqlite3_column_text(res, 0));
+        row.artist = arena_insert_const(result->arena, sqlite3_column_text(res, 1));
+        id = g_new(gint64, 1);
+        *id = row.id;
+        g_hash_table_insert(ids, id, GUINT_TO_POINTER(result->rows->len));
+        g_array_append_val(result->rows, row);
+    }
+    return ret;
+}
+
+/* Add the tracks of 'res' whose file is still there to 'result' */
+static int media_browse_read_items(MediaBrowseResult_t *result,
+                                   sqlite3_stmt *res, GString *uri_buf)
+{
+    int ret;
+
+    while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+        const char *path = (const char *) sqlite3_column_text(res, 0);
+        MediaItem_t item;
+
+        if (!media_validator_is_valid(path))
+            continue;
+
+        media_item_set_row(&item, res, result->arena, uri_buf);
+        g_array_append_val(result->items, item);
+    }
+    return ret;
+}
+
+/*
+ * Run 'sql' on the mounted device 'device', or on every mounted device if
+ * NULL, in one read transaction, and add its rows to the rows or the
+ * items of 'result'.
+ */
+static gint media_browse_read(MediaBrowseResult_t *result, const gchar *sql,
+                              const gchar *album, const gchar *artist,
+                              const gchar *device, gchar **error)
+{
+    GPtrArray *devices = g_ptr_array_new_with_free_func(g_free);
+    GHashTable *ids = NULL;
+    MediaDBConn_t *conn;
+    sqlite3_stmt *res;
+    GString *uri_buf = NULL;
+    guint i;
+    int ret = SQLITE_DONE;
+
+    if (device) {
+        g_ptr_array_add(devices, g_strdup(device));
+    } else {
+        media_mounts_foreach(media_browse_add_device, devices);
+        g_ptr_array_sort(devices, media_browse_device_cmp);
+    }
+
+    conn = media_db_acquire(error);
+    if (!conn) {
+        g_ptr_array_free(devices, TRUE);
+        return -1;
+    }
+
+    res = media_db_statement(conn, sql, error);
+    if (!res || media_db_begin(conn, error) < 0) {
+        media_db_release(conn);
+        g_ptr_array_free(devices, TRUE);
+        return -1;
+    }
+
+    if (result->rows)
+        ids = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    else
+        uri_buf = g_string_sized_new(PATH_MAX);
+
+    for (i = 0; ret == SQLITE_DONE && i < devices->len; i++) {
+        media_db_bind_prefix(res, g_ptr_array_index(devices, i));
+        media_db_bind_text(res, ":album", album);
+        media_db_bind_text(res, ":artist", artist);
+
+        if (result->rows)
+            ret = media_browse_read_rows(result, res, ids);
+        else
+            ret = media_browse_read_items(result, res, uri_buf);
+        sqlite3_reset(res);
+        sqlite3_clear_bindings(res);
+    }
+    media_db_end(conn);
+    media_db_release(conn);
+
+    if (ids)
+        g_hash_table_destroy(ids);
+    if (uri_buf)
+        g_string_free(uri_buf, TRUE);
+    g_ptr_array_free(devices, TRUE);
+
+    if (ret != SQLITE_DONE) {
+        LOGE("Cannot browse media: %s\n", sqlite3_errstr(ret));
+        media_db_read_failed(ret, error);
+        return -1;
+    }
+    if (result->rows)
+        g_array_sort(result->rows, media_browse_row_cmp);
+    return 0;
+}
+
+static MediaBrowseResult_t *media_browse_run(MediaBrowseResult_t *result,
+                                             const gchar *sql,
+                                             const gchar *album,
+                                             const gchar *artist,
+                                             const gchar *device,
+                                             gchar **error)
+{
+    result->arena = g_string_chunk_new(MEDIA_ARENA_CHUNK_SIZE / 16);
+    if (media_browse_read(result, sql, album, artist, device, error) < 0) {
+        media_browse_result_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/*
+ * Artists, albums or genres of the audio library with their track count
+ * and total duration, on the device mounted at 'device' or on every
+ * mounted device if NULL. 'artist', if not NULL, restricts albums to
+ * those holding tracks of that artist.
+ */
+MediaBrowseResult_t *media_browse(MediaBrowseView_t view, const gchar *artist,
+                                  const gchar *device, gchar **error)
+{
+    MediaBrowseResult_t *result = g_malloc0(sizeof(*result));
+
+    result->rows = g_array_new(FALSE, FALSE, sizeof(MediaBrowseRow_t));
+    return media_browse_run(result, browse_queries[view], NULL,
+                            view == MEDIA_BROWSE_ALBUMS ? artist : NULL,
+                            device, error);
+}
+
+/*
+ * Tracks of the albums named 'album', of 'artist' unless it is NULL, on
+ * the device mounted at 'device' or on every mounted device if NULL.
+ * Only the MEDIA_FIELD_* of 'fields' are read, 0 for all of them.
+ */
+MediaBrowseResult_t *media_browse_tracks(const gchar *album,
+                                         const gchar *artist,
+                                         const gchar *device, gint fields,
+                                         gchar **error)
+{
+    MediaBrowseResult_t *result = g_malloc0(sizeof(*result));
+    const gchar *columns[5];
+    gchar *sql;
+
+    media_sql_columns(lms_queries[LMS_AUDIO_ID].columns,
+                      fields ? fields : MEDIA_FIELD_ALL, columns);
+    sql = g_strdup_printf(BROWSE_SQL_TRACKS_COLUMNS("%s", "%s", "%s", "%s", "%s"),
+                          columns[0], columns[1], columns[2], columns[3],
+                          columns[4]);
+
+    result->items = g_array_new(FALSE, FALSE, sizeof(MediaItem_t));
+    result = media_browse_run(result, sql, album, artist, device, error);
+    g_free(sql);
+    return result;
+}
+
+void media_browse_result_free(MediaBrowseResult_t *result)
+{
+    if (!result)
+        return;
+
+    if (result->rows)
+        g_array_free(result->rows, TRUE);
+    if (result->items)
+        g_array_free(result->items, TRUE);
+    g_string_chunk_free(result->arena);
+    g_free(result);
+}
+
+/*
+ * Device summaries
+ *
+ * Counted by SQLite over the files.path range of each device, so that
+ * learning what a device holds costs no item.
+ */
+static void media_summary_device_free(MediaSummaryDevice_t *dev)
+{
+    g_free(dev->path);
+}
+
+static void media_summary_add_device(const MediaMount_t *mount, gpointer data)
+{
+    MediaSummaryDevice_t dev = { 0 };
+
+    if (mount->state == MEDIA_MOUNT_REMOVED)
+        return;
+
+    dev.path = g_strdup(mount->path);
+    g_array_append_val(data, dev);
+}
+
+static gint media_summary_device_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(((const MediaSummaryDevice_t *) a)->path,
+                  ((const MediaSummaryDevice_t *) b)->path);
+}
+
+/* Fill the counts of 'dev' for category 'id' */
+static gint media_summary_read(MediaDBConn_t *conn, MediaSummaryDevice_t *dev,
+                               gint id, gchar **error)
+{
+    MediaSummaryCount_t *count = &dev->counts[id];
+    sqlite3_stmt *res;
+    int ret;
+
+    res = media_db_statement(conn, lms_queries[id].summary, error);
+    if (!res)
+        return -1;
+
+    media_db_bind_prefix(res, dev->path);
+    ret = sqlite3_step(res);
+    if (ret == SQLITE_ROW) {
+        count->count = sqlite3_column_int(res, 0);
+        count->duration = sqlite3_column_int64(res, 1) * 1000;
+        count->update_id = sqlite3_column_int64(res, 2);
+    }
+    sqlite3_reset(res);
+    sqlite3_clear_bindings(res);
+
+    if (ret != SQLITE_ROW) {
+        LOGE("Cannot count %s media: %s\n", lms_scan_types[id],
+             sqlite3_errstr(ret));
+        media_db_read_failed(ret, error);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Number and total duration of the media of every category on each
+ * mounted device, or only on the one mounted at 'device' if not NULL.
+ * Every count is read in one read transaction.
+ */
+MediaSummary_t *media_summary(const gchar *device, gchar **error)
+{
+    MediaSummary_t *summary = g_malloc0(sizeof(*summary));
+    MediaDBConn_t *conn;
+    guint i;
+    gint id;
+    gint ret = 0;
+
+    summary->update_id = media_lms_update_id();
+    summary->devices = g_array_new(FALSE, FALSE, sizeof(MediaSummaryDevice_t));
+    g_array_set_clear_func(summary->devices,
+                           (GDestroyNotify) media_summary_device_free);
+    if (device) {
+        MediaSummaryDevice_t dev = { .path = g_strdup(device) };
+
+        g_array_append_val(summary->devices, dev);
+    } else {
+        media_mounts_foreach(media_summary_add_device, summary->devices);
+        g_array_sort(summary->devices, media_summary_device_cmp);
+    }
+
+    conn = media_db_acquire(error);
+    if (!conn) {
+        media_summary_free(summary);
+        return NULL;
+    }
+
+    ret = media_db_begin(conn, error);
+    if (ret == 0) {
+        for (i = 0; ret == 0 && i < summary->devices->len; i++) {
+            MediaSummaryDevice_t *dev = &g_array_index(summary->devices,
+                                                       MediaSummaryDevice_t, i);
+
+            for (id = LMS_MIN_ID; ret == 0 && id < LMS_SCAN_COUNT; ++id)
+                ret = media_summary_read(conn, dev, id, error);
+        }
+        media_db_end(conn);
+    }
+    media_db_release(conn);
+
+    if (ret < 0) {
+        media_summary_free(summary);
+        return NULL;
+    }
+    return summary;
+}
+
+void media_summary_free(MediaSummary_t *summary)
+{
+    if (!summary)
+        return;
+
+    g_array_free(summary->devices, TRUE);
+    g_free(summary);
+}
+
+/*
+ * Cursors are handed to clients as an opaque base64 string of
+ * "<version>:<scan type>:<key count>[:i<integer>|:s<base64 text>]..."
+ */
+#define MEDIA_CURSOR_VERSION 1
+
+gchar *media_cursor_encode(const MediaCursor_t *cursor)
+{
+    GString *str = g_string_new(NULL);
+    gchar *encoded;
+    gint i;
+
+    g_string_append_printf(str, "%d:%d:%d", MEDIA_CURSOR_VERSION,
+                           cursor->scan_type_id, cursor->n_keys);
+    for (i = 0; i < cursor->n_keys; i++) {
+        if (cursor->keys[i].is_text) {
+            gchar *text = g_base64_encode((const guchar *) cursor->keys[i].text,
+                                          strlen(cursor->keys[i].text));
+            g_string_append_printf(str, ":s%s", text);
+            g_free(text);
+        } else {
+            g_string_append_printf(str, ":i%" G_GINT64_FORMAT, cursor->keys[i].num);
+        }
+    }
+
+    encoded = g_base64_encode((const guchar *) str->str, str->len);
+    g_string_free(str, TRUE);
+    return encoded;
+}
+
+MediaCursor_t *media_cursor_decode(const gchar *str)
+{
+    MediaCursor_t *cursor = NULL;
+    guchar *raw;
+    gchar *text, *end;
+    gchar **fields;
+    gsize len;
+    guint n, i;
+
+    if (!str || !*str)
+        return NULL;
+
+    raw = g_base64_decode(str, &len);
+    text = g_strndup((const gchar *) raw, len);
+    g_free(raw);
+    fields = g_strsplit(text, ":", -1);
+    g_free(text);
+
+    n = g_strv_length(fields);
+    if (n < 3 || g_ascii_strtoll(fields[0], &end, 10) != MEDIA_CURSOR_VERSION || *end)
+        goto out;
+
+    cursor = g_malloc0(sizeof(*cursor));
+    cursor->scan_type_id = g_ascii_strtoll(fields[1], &end, 10);
+    if (*end || cursor->scan_type_id < LMS_MIN_ID ||
+        cursor->scan_type_id >= LMS_SCAN_COUNT)
+        goto fail;
+
+    i = g_ascii_strtoll(fields[2], &end, 10);
+    if (*end || (i != 0 && i != lms_queries[cursor->scan_type_id].n_keys) ||
+        n != 3 + i)
+        goto fail;
+
+    for (i = 0; i < n - 3; i++) {
+        const gchar *field = fields[3 + i];
+
+        if (field[0] == 's') {
+            raw = g_base64_decode(field + 1, &len);
+            cursor->keys[i].is_text = TRUE;
+            cursor->keys[i].text = g_strndup((const gchar *) raw, len);
+            g_free(raw);
+        } else if (field[0] == 'i' && field[1]) {
+            cursor->keys[i].num = g_ascii_strtoll(field + 1, &end, 10);
+            if (*end)
+                goto fail;
+        } else {
+            goto fail;
+        }
+        cursor->n_keys = i + 1;
+    }
+    goto out;
+
+fail:
+    media_cursor_free(cursor);
+    cursor = NULL;
+out:
+    g_strfreev(fields);
+    return cursor;
+}
+
+void media_cursor_free(MediaCursor_t *cursor)
+{
+    if (cursor) {
+        media_cursor_clear(cursor);
+        g_free(cursor);
+    }
+}
+
+void media_match_free(MediaMatch_t *match)
+{
+    if (match) {
+        g_free(match->artist);
+        g_free(match->album);
+        g_free(match->genre);
+        g_free(match->title);
+        g_free(match);
+    }
+}
+
+static MediaList_t *media_list_new(gint scan_type_id)
+{
+    MediaList_t *mlist = g_malloc0(sizeof(*mlist));
+
+    mlist->items = g_array_sized_new(FALSE, FALSE, sizeof(MediaItem_t),
+                                     MEDIA_LIST_PREALLOC);
+    mlist->scan_type_str = lms_scan_types[scan_type_id];
+    mlist->scan_type_id = scan_type_id;
+    return mlist;
+}
+
+static void media_list_free(MediaList_t *mlist)
+{
+    g_array_free(mlist->items, TRUE);
+    g_free(mlist);
+}
+
+/*
+ * Allocate a device with one empty list per scan type requested
+ * by 'filters' and the string arena backing every item of the scan
+ */
+MediaDevice_t *media_device_new(ScanFilter_t *filters)
+{
+    MediaDevice_t *mdev = g_malloc0(sizeof(*mdev));
+    gint i;
+
+    for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
+    {
+        if(filters->scan_types & (1 << i))
+            mdev->lists[i] = media_list_new(i);
+    }
+    mdev->arena = g_string_chunk_new(MEDIA_ARENA_CHUNK_SIZE);
+    mdev->filters = filters;
+    return mdev;
+}
+
+/*
+ * Whether mdev may not match the LMS database any more: LMS updated it
+ * since, or was writing to it, committing rows without a new UpdateID.
+ */
+gboolean media_device_is_stale(MediaDevice_t *mdev)
+{
+    return mdev->write_locked || media_lms_write_locked() ||
+           mdev->update_id != media_lms_update_id();
+}
+
+/* Number of items in mdev */
+gint media_device_count(MediaDevice_t *mdev)
+{
+    gint count = 0;
+    gint id;
+
+    for (id = LMS_MIN_ID; id < LMS_SCAN_COUNT; ++id) {
+        if (mdev->lists[id])
+            count += mdev->lists[id]->items->len;
+    }
+    return count;
+}
+
+/*
+ * Drop from mdev the items whose path is in 'seen' and add the others to
+ * it. Lists left empty are freed. Returns the number of items left.
+ */
+gint media_device_drop_seen(MediaDevice_t *mdev, GHashTable *seen)
+{
+    gint left = 0;
+    guint i, j;
+    gint id;
+
+    for (id = LMS_MIN_ID; id < LMS_SCAN_COUNT; ++id) {
+        GArray *items;
+
+        if (!mdev->lists[id])
+            continue;
+
+        items = mdev->lists[id]->items;
+        for (i = 0, j = 0; i < items->len; i++) {
+            const MediaItem_t *item = &g_array_index(items, MediaItem_t, i);
 
-/* ------ LOCAL  FUNCTIONS --------- */
+            if (g_hash_table_contains(seen, item->path))
+                continue;
+            g_hash_table_add(seen, g_strdup(item->path));
+            g_array_index(items, MediaItem_t, j++) = *item;
+        }
+        g_array_set_size(items, j);
 
-void ListLock() {
-    g_mutex_lock(&(MediaPlayerManage.m));
+        if (j == 0) {
+            media_list_free(mdev->lists[id]);
+            mdev->lists[id] = NULL;
+        }
+        left += j;
+    }
+    return left;
 }
 
-void ListUnlock() {
-    g_mutex_unlock(&(MediaPlayerManage.m));
+/* Free the lists of mdev along with the strings of their items */
+static void media_device_clear(MediaDevice_t *mdev)
+{
+    gint id;
+
+    for (id = LMS_MIN_ID; id < LMS_SCAN_COUNT; ++id) {
+        if (mdev->lists[id]) {
+            media_list_free(mdev->lists[id]);
+            mdev->lists[id] = NULL;
+        }
+    }
+    g_string_chunk_clear(mdev->arena);
 }
 
-void DebugTraceSendMsg(int level, gchar* message)
+/*
+ * Hand the media of mdev->filters to 'func' in chunks of 'chunk_size'
+ * items, leaving out the paths in 'seen' (NULL for none), which is left
+ * unchanged. Each category is read by one statement stepped across the
+ * whole device, in files.path order, so a chunk goes out as soon as its
+ * rows are read. mdev only holds the items of a chunk for the time of
+ * the call. The last call has 'complete' set and may hold no items.
+ *
+ * Everything is read in one read transaction. Returns the number of
+ * items handed over, or -1 on error, after which 'func' is not called.
+ */
+gint media_device_stream(MediaDevice_t *mdev, gint chunk_size, GHashTable *seen,
+                         MediaChunkFunc func, gpointer data, gchar **error)
 {
-#ifdef LOCAL_PRINT_DEBUG
-    switch (level)
-    {
-            case DT_LEVEL_ERROR:
-                g_print("[E]");
-                break;
-
-            case DT_LEVEL_WARNING:
-                g_print("[W]");
-                break;
+    MediaDBConn_t *conn;
+    GString *uri_buf;
+    sqlite3_stmt *res;
+    gint total = 0;
+    gint num = 0;
+    gint id;
+    int ret = SQLITE_DONE;
 
-            case DT_LEVEL_NOTICE:
-                g_print("[N]");
-                break;
+    conn = media_db_acquire(error);
+    if (!conn)
+        return -1;
+    if (media_db_begin(conn, error) < 0) {
+        media_db_release(conn);
+        return -1;
+    }
 
-            case DT_LEVEL_INFO:
-                g_print("[I]");
-                break;
+    media_device_clear(mdev);
+    uri_buf = g_string_sized_new(PATH_MAX);
+    for (id = LMS_MIN_ID; ret == SQLITE_DONE && id < LMS_SCAN_COUNT; ++id) {
+        if (!(mdev->filters->scan_types & (1 << id)))
+            continue;
 
-            case DT_LEVEL_DEBUG:
-                g_print("[D]");
-                break;
+        res = media_db_statement(conn, lms_queries[id].stream, error);
+        if (!res) {
+            ret = SQLITE_ERROR;
+            break;
+        }
+        media_db_bind_prefix(res, mdev->filters->scan_uri);
+
+        while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+            const char *path = (const char *) sqlite3_column_text(res, 0);
+            MediaItem_t item;
+
+            if (!media_validator_is_valid(path))
+                continue;
+            if (seen) {
+                g_string_assign(uri_buf, "file://");
+                g_string_append_uri_escaped(uri_buf, path, "/", TRUE);
+                if (g_hash_table_contains(seen, uri_buf->str))
+                    continue;
+            }
 
-            default:
-                g_print("[-]");
-                break;
-    }
+            /* A full chunk waits for one more row, the last one is complete */
+            if (num == chunk_size) {
+                func(mdev, num, FALSE, data);
+                media_device_clear(mdev);
+                num = 0;
+            }
 
-    g_print("%s",message);
-#endif
+            media_item_set_row(&item, res, mdev->arena, uri_buf);
+            if (!mdev->lists[id])
+                mdev->lists[id] = media_list_new(id);
+            g_array_append_val(mdev->lists[id]->items, item);
+            num++;
+            total++;
+        }
+        sqlite3_reset(res);
+        sqlite3_clear_bindings(res);
 
-    if (message) {
-        g_free(message);
+        if (ret != SQLITE_DONE) {
+            LOGE("Cannot read %s media: %s\n", lms_scan_types[id],
+                 sqlite3_errstr(ret));
+            media_db_read_failed(ret, error);
+        }
     }
+    media_db_end(conn);
+    media_db_release(conn);
+    g_string_free(uri_buf, TRUE);
+
+    if (ret == SQLITE_DONE)
+        func(mdev, num, TRUE, data);
+    media_device_clear(mdev);
 
+    return ret == SQLITE_DONE ? total : -1;
 }
 
-static void media_item_free(gpointer data)
+void media_device_free(MediaDevice_t *mdev)
 {
-    MediaItem_t *item = data;
+    gint i;
 
-	g_free(item->metadata.title);
-	g_free(item->metadata.artist);
-	g_free(item->metadata.album);
-	g_free(item->metadata.genre);
-	g_free(item->path);
-	g_free(item);
+    if(mdev){
+        for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
+        {
+            if(mdev->lists[i] != NULL)
+                media_list_free(mdev->lists[i]);
+        }
+        g_string_chunk_free(mdev->arena);
+        media_cursor_free(mdev->next_cursor);
+        g_free(mdev);
+    }
 }
 
-gint media_lightmediascanner_scan(MediaList_t *mlist, gchar* uri, gchar **error)
+/*
+ * Append to mdev the media of its categories LMS added below its scan
+ * URI after the files of after_ids, which are moved to the last file
+ * read. Returns the number of media appended, or -1 on error, in which
+ * case after_ids are left alone so that the next call reads them again.
+ */
+static gint media_progress_get(MediaDevice_t *mdev, gint64 *after_ids,
+                              gchar **error)
 {
+    gint64 last_ids[LMS_SCAN_COUNT];
+    MediaDBConn_t *conn;
+    GString *uri_buf;
     sqlite3_stmt *res;
-    const char *tail;
-    const gchar *db_path;
-    gchar *query;
-    int ret = 0;
     gint num = 0;
+    gint id;
+    int ret = SQLITE_DONE;
 
-    if(!scanDB.is_open) {
-        db_path = scanner1_get_data_base_path(MediaPlayerManage.lms_proxy);
-
-        ret = sqlite3_open(db_path, &scanDB.db);
-        if (ret != SQLITE_OK) {
-            LOGD("Cannot open SQLITE database: '%s'\n", db_path);
-            scanDB.is_open = FALSE;
-            g_list_free_full(mlist,media_item_free);
-            return -1;
-        }
-        scanDB.is_open = TRUE;
+    conn = media_db_acquire(error);
+    if (!conn)
+        return -1;
+    if (media_db_begin(conn, error) < 0) {
+        media_db_release(conn);
+        return -1;
     }
 
-    switch (mlist->scan_type_id) {
-        case LMS_VIDEO_ID:
-            query = g_strdup_printf(VIDEO_SQL_QUERY, uri ? uri : "");
-            break;
-        case LMS_IMAGE_ID:
-            query = g_strdup_printf(IMAGE_SQL_QUERY, uri ? uri : "");
+    uri_buf = g_string_sized_new(PATH_MAX);
+    for (id = LMS_MIN_ID; ret == SQLITE_DONE && id < LMS_SCAN_COUNT; ++id) {
+        last_ids[id] = after_ids[id];
+        if (!mdev->lists[id])
+            continue;
+
+        res = media_db_statement(conn, lms_queries[id].progress, error);
+        if (!res) {
+            ret = SQLITE_ERROR;
             break;
-        case LMS_AUDIO_ID:
-        default:
-            query = g_strdup_printf(AUDIO_SQL_QUERY, uri ? uri : "");
+        }
+        media_db_bind_prefix(res, mdev->filters->scan_uri);
+        sqlite3_bind_int64(res, sqlite3_bind_parameter_index(res, ":after_id"),
+                           after_ids[id]);
+
+        while ((ret = sqlite3_step(res)) == SQLITE_ROW) {
+            const char *path = (const char *) sqlite3_column_text(res, 0);
+            MediaItem_t item;
+
+            last_ids[id] = sqlite3_column_int64(res, MEDIA_SQL_KEY_COLUMN);
+            if (!media_validator_is_valid(path))
+                continue;
+
+            media_item_set_row(&item, res, mdev->arena, uri_buf);
+            g_array_append_val(mdev->lists[id]->items, item);
+            num++;
+        }
+        sqlite3_reset(res);
+        sqlite3_clear_bindings(res);
+
+        if (ret != SQLITE_DONE) {
+            LOGE("Cannot read new %s media: %s\n", lms_scan_types[id],
+                 sqlite3_errstr(ret));
+            media_db_read_failed(ret, error);
+        }
     }
+    media_db_end(conn);
+    media_db_release(conn);
+    g_string_free(uri_buf, TRUE);
 
-    if (!query) {
-        *error = g_strdup_printf("Cannot allocate memory for query");
+    if (ret != SQLITE_DONE)
         return -1;
+
+    for (id = LMS_MIN_ID; id < LMS_SCAN_COUNT; ++id) {
+        after_ids[id] = last_ids[id];
+        if (mdev->lists[id] && mdev->lists[id]->items->len == 0) {
+            media_list_free(mdev->lists[id]);
+            mdev->lists[id] = NULL;
+        }
     }
+    return num;
+}
 
-    ret = sqlite3_prepare_v2(scanDB.db, query, (int) strlen(query), &res, &tail);
-    if (ret) {
-        *error = g_strdup("Cannot execute query");
-        g_free(query);
-        return -1;
+/*
+ * Refresh after LMS updates, once a burst of PropertiesChanged signals is
+ * over. The state is only used from the event loop, but for the counters.
+ */
+static struct {
+    guint timer;        /* pending refresh source, 0 for none */
+    gboolean done;      /* a refresh already ran */
+    guint64 update_id;  /* UpdateID at the last refresh */
+    gint signals;       /* PropertiesChanged received */
+    gint coalesced;     /* refreshes merged into a later one */
+    gint unchanged;     /* refreshes skipped, UpdateID did not advance */
+    gint refreshes;     /* refreshes run */
+} refresh = { 0 };
+
+/* Announce the devices LMS is done indexing */
+static void media_announce_pending(void)
+{
+    ScanFilter_t *filter = &MediaPlayerManage.filters;
+    gchar **pending;
+    gint i;
+
+    if (!filter->scan_types || !g_RegisterCallback.binding_device_added)
+        return;
+
+    /* media_added is reported once per mounted device, other devices are left alone */
+    pending = media_mounts_pending();
+    for (i = 0; pending[i]; i++) {
+        ScanFilter_t device;
+
+        ListLock();
+        device = *filter;
+        ListUnlock();
+        device.scan_uri = pending[i];
+        device.cursor = NULL;
+
+        g_RegisterCallback.binding_device_added(&device);
+        media_mount_ready(pending[i]);
+        /* From now on, changes are announced as they happen */
+        media_watch_add(pending[i]);
     }
+    g_strfreev(pending);
+}
 
-    while (sqlite3_step(res) == SQLITE_ROW) {
-        struct stat buf;
-        MediaItem_t *item = NULL;
-        const char *path = (const char *) sqlite3_column_text(res, 0);
-        gchar *tmp;
+static gboolean media_refresh_cb(gpointer unused)
+{
+    const guint64 update_id = media_lms_update_id();
 
-        ret = stat(path, &buf);
-        if (ret)
-            continue;
+    refresh.timer = 0;
 
-        //We may check the allocation result ... but It maybe a bit expensive in such a loop
-        item = g_malloc0(sizeof(*item));
+    if (refresh.done && refresh.update_id == update_id) {
+        g_atomic_int_inc(&refresh.unchanged);
+    } else {
+        g_atomic_int_inc(&refresh.refreshes);
+        refresh.done = TRUE;
+        refresh.update_id = update_id;
 
-        tmp = g_uri_escape_string(path, "/", TRUE);
-        item->path = g_strdup_printf("file://%s", tmp);
-        g_free(tmp);
+        /* LMS is done updating its database, previous verdicts may be stale */
+        media_validator_reset();
 
-        item->metadata.title = g_strdup((gchar *) sqlite3_column_text(res, 1));
-        item->metadata.artist = g_strdup((gchar *) sqlite3_column_text(res, 2));
-        item->metadata.album = g_strdup((gchar *) sqlite3_column_text(res, 3));
-        item->metadata.genre = g_strdup((gchar *) sqlite3_column_text(res, 4));
-        item->metadata.duration = sqlite3_column_int(res, 5) * 1000;
-        mlist->list = g_list_append(mlist->list, item);
-        num++;
+        /* Index the new catalogue for search */
+        media_search_update();
     }
-    g_free(query);
 
-    return num;
+    /* LMS is idle: reads may wait for its lock again */
+    media_db_busy_reset();
+
+    /* LMS is idle: scans over are reported, those requested meanwhile go */
+    media_scan_lms_idle();
+
+    /* A device may well be indexed without any change to the database */
+    media_announce_pending();
+
+    return G_SOURCE_REMOVE;
 }
 
-void media_device_free(MediaDevice_t *mdev)
+/*
+ * Progress of the current LMS scan through each "category:path" it
+ * reported, only used from the event loop. Dropped once LMS is idle, or
+ * for the paths of a device as it goes away.
+ */
+typedef struct {
+    guint64 processed;                  /* files LMS processed there */
+    gint64 last_ids[LMS_SCAN_COUNT];    /* last file announced there */
+} MediaProgress_t;
+
+static GHashTable *progress = NULL;
+
+/* Progress of the current scan through 'category' at 'path' */
+static MediaProgress_t *media_progress_lookup(const gchar *category,
+                                              const gchar *path)
 {
-    gint i;
+    gchar *key = g_strconcat(category, ":", path, NULL);
+    MediaProgress_t *state;
 
-    if(mdev){
-        for(i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
-        {
-            if(mdev->lists[i] != NULL) {
-                g_list_free_full(mdev->lists[i]->list,media_item_free);
-                g_free(mdev->lists[i]);
-            }
-        }
-        g_free(mdev->filters->scan_uri);
-        mdev->filters->scan_uri = NULL;
-        g_free(mdev);
+    if (!progress)
+        progress = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    state = g_hash_table_lookup(progress, key);
+    if (!state) {
+        state = g_malloc0(sizeof(*state));
+        g_hash_table_insert(progress, key, state);
+    } else {
+        g_free(key);
+    }
+    return state;
+}
+
+/* Forget the progress at or below 'root', or all of it if NULL */
+static void media_progress_reset(const gchar *root)
+{
+    GHashTableIter iter;
+    const gchar *key;
+
+    if (!progress)
+        return;
+    if (!root) {
+        g_hash_table_remove_all(progress);
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, progress);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &key, NULL)) {
+        const gchar *path = strchr(key, ':') + 1;
+
+        if (g_str_equal(path, root) || media_path_is_below(path, root))
+            g_hash_table_iter_remove(&iter);
     }
 }
 
@@ -211,7 +1712,6 @@ on_interface_proxy_properties_changed (GDBusProxy *proxy,
     gchar *key = NULL;
     GVariant *subValue = NULL;
     const gchar *pInterface;
-    ScanFilter_t *filter = &MediaPlayerManage.filters;
     gboolean br = FALSE;
 
     pInterface = g_dbus_proxy_get_interface_name (proxy);
@@ -219,27 +1719,58 @@ on_interface_proxy_properties_changed (GDBusProxy *proxy,
     if (0 != g_strcmp0(pInterface, LIGHTMEDIASCANNER_INTERFACE))
         return;
 
+    g_atomic_int_inc(&refresh.signals);
+
     g_variant_iter_init (&iter, changed_properties);
     while (g_variant_iter_loop(&iter, "{&sv}", &key, &subValue))
     {
         gboolean val;
         if (0 == g_strcmp0(key,"IsScanning")) {
             g_variant_get(subValue, "b", &val);
-            if (val == TRUE)
+            if (val == TRUE) {
                 br = TRUE;
+                media_scan_lms_scanning();
+            } else {
+                media_progress_reset(NULL);
+                media_mounts_scanned();
+            }
         } else if (0 == g_strcmp0(key, "WriteLocked")) {
             g_variant_get(subValue, "b", &val);
             if (val == TRUE)
                 br = TRUE;
+        } else if (0 == g_strcmp0(key, "UpdateID")) {
+            /* The database changed, so may have every cached reply */
+            media_cache_invalidate();
         }
     }
+
+    /* A pending refresh is superseded by the one after this update */
+    if (refresh.timer) {
+        g_source_remove(refresh.timer);
+        refresh.timer = 0;
+        g_atomic_int_inc(&refresh.coalesced);
+    }
+
     if(br)
         return;
 
-    if (filter->scan_types &&
-        filter->scan_uri &&
-        g_RegisterCallback.binding_device_added)
-        g_RegisterCallback.binding_device_added(filter);
+    refresh.timer = g_timeout_add(MEDIA_REFRESH_DEBOUNCE, media_refresh_cb, NULL);
+}
+
+void media_refresh_stats(MediaRefreshStats_t *stats)
+{
+    stats->signals = g_atomic_int_get(&refresh.signals);
+    stats->coalesced = g_atomic_int_get(&refresh.coalesced);
+    stats->unchanged = g_atomic_int_get(&refresh.unchanged);
+    stats->refreshes = g_atomic_int_get(&refresh.refreshes);
+}
+
+/* Current LMS UpdateID, i.e. the version of the database contents */
+guint64 media_lms_update_id(void)
+{
+    if (MediaPlayerManage.lms_proxy == NULL)
+        return 0;
+    return scanner1_get_update_id(MediaPlayerManage.lms_proxy);
 }
 
 static int MediaPlayerDBusInit(void)
@@ -259,6 +1790,99 @@ static int MediaPlayerDBusInit(void)
     return 0;
 }
 
+/* Scan types of an LMS category name, 0 for unknown categories */
+static gint media_scan_types_of_category(const gchar *category)
+{
+    if (!g_ascii_strcasecmp(category, "audio"))
+        return LMS_AUDIO_SCAN;
+    if (!g_ascii_strcasecmp(category, "video"))
+        return LMS_VIDEO_SCAN;
+    if (!g_ascii_strcasecmp(category, "picture") ||
+        !g_ascii_strcasecmp(category, "image"))
+        return LMS_IMAGE_SCAN;
+    if (!g_ascii_strcasecmp(category, "multimedia"))
+        return LMS_AUDIO_SCAN | LMS_VIDEO_SCAN;
+    return 0;
+}
+
+/*
+ * LMS reports its progress through each category and scanned directory.
+ * Whenever it has processed new files there, the files it committed
+ * since the last report are announced, so that they can be played before
+ * the scan is over. Only those are read: the media after the last file
+ * announced there, in files.id order.
+ */
+static void
+on_scan_progress (Scanner1 *proxy, const gchar *category, const gchar *path,
+                  guint64 up_to_date, guint64 processed, guint64 deleted,
+                  guint64 skipped, guint64 errors, gpointer udata)
+{
+    MediaProgress_t *state;
+    MediaDevice_t *mdev;
+    gchar *error = NULL;
+    gchar *root;
+    gsize len;
+    gchar **devices;
+    ScanFilter_t filter;
+    gint scan_types;
+    gint i;
+
+    LOGD("%s %s: %" G_GUINT64_FORMAT " processed, %" G_GUINT64_FORMAT " up to date\n",
+         category, path, processed, up_to_date);
+
+    state = media_progress_lookup(category, path);
+    if (processed == 0 || state->processed == processed)
+        return;
+    state->processed = processed;
+
+    /* Only devices yet to be announced are announced progressively */
+    devices = media_mount_indexing(path);
+    if (!devices[0]) {
+        g_strfreev(devices);
+        return;
+    }
+
+    ListLock();
+    filter = MediaPlayerManage.filters;
+    ListUnlock();
+
+    scan_types = filter.scan_types & media_scan_types_of_category(category);
+    if (!scan_types || !g_RegisterCallback.binding_device_progress) {
+        g_strfreev(devices);
+        return;
+    }
+
+    /* Scan URIs have no trailing '/' */
+    root = g_strdup(path);
+    len = strlen(root);
+    if (len > 1 && root[len - 1] == '/')
+        root[len - 1] = '\0';
+
+    filter.scan_types = scan_types;
+    filter.limit = 0;
+    filter.cursor = NULL;
+    filter.match = NULL;
+    for (i = 0; devices[i]; i++) {
+        /* The directory on the device, or the whole device below it */
+        if (g_str_equal(root, devices[i]) || media_path_is_below(root, devices[i]))
+            filter.scan_uri = root;
+        else
+            filter.scan_uri = devices[i];
+
+        state = media_progress_lookup(category, filter.scan_uri);
+        mdev = media_device_new(&filter);
+        if (media_progress_get(mdev, state->last_ids, &error) > 0)
+            g_RegisterCallback.binding_device_progress(mdev, devices[i]);
+        else if (error)
+            LOGE("Cannot announce new media: %s\n", error);
+        media_device_free(mdev);
+        g_free(error);
+        error = NULL;
+    }
+    g_free(root);
+    g_strfreev(devices);
+}
+
 static void *media_event_loop_thread(void *unused)
 {
     GMainLoop *loop = g_main_loop_new(NULL, FALSE);
@@ -270,6 +1894,10 @@ static void *media_event_loop_thread(void *unused)
                       "g-properties-changed",
                       G_CALLBACK (on_interface_proxy_properties_changed),
                       NULL);
+    g_signal_connect (MediaPlayerManage.lms_proxy,
+                      "scan-progress",
+                      G_CALLBACK (on_scan_progress),
+                      NULL);
 
     LOGD("g_main_loop_run\n");
     g_main_loop_run(loop);
@@ -277,6 +1905,114 @@ static void *media_event_loop_thread(void *unused)
     return NULL;
 }
 
+/* The scan of a new device is over, it is announced once LMS is idle */
+static void media_mount_scan_done(const gchar *error, gpointer data)
+{
+    gchar *path = data;
+
+    if (error)
+        LOGE("Cannot index %s: %s\n", path, error);
+    else
+        media_mount_indexed(path);
+    g_free(path);
+}
+
+/* A device got mounted at 'path', or unmounted from it */
+static void media_device_mount_changed(const gchar *path, gboolean mounted)
+{
+    gchar *uri = media_path_to_uri(path);
+
+    ListLock();
+    if (!mounted) {
+        if (g_RegisterCallback.binding_device_removed)
+            g_RegisterCallback.binding_device_removed(uri);
+        media_mount_removed(path);
+        media_progress_reset(path);
+        media_validator_device_removed(path);
+        media_scan_cancel(path);
+        media_watch_remove(path);
+        /* Connections still running a query are closed once it is done */
+        media_db_close_all();
+    } else {
+        media_mount_added(path);
+        media_validator_device_added(path);
+        /* Only what subscribers asked for, only on the new device */
+        media_scan_request(path, MediaPlayerManage.filters.scan_types,
+                           media_mount_scan_done, g_strdup(path));
+    }
+
+    g_free(uri);
+    ListUnlock();
+}
+
+/* Media appeared at or below 'added' are announced once LMS has them */
+typedef struct {
+    GHashTable *added;
+    gint pending;           /* directory scans still running */
+} MediaDelta_t;
+
+static void media_delta_scanned(const gchar *error, gpointer data)
+{
+    MediaDelta_t *delta = data;
+    ScanFilter_t filter;
+
+    if (error)
+        LOGE("Cannot scan changed directory: %s\n", error);
+    if (--delta->pending > 0)
+        return;
+
+    ListLock();
+    filter = MediaPlayerManage.filters;
+    ListUnlock();
+    filter.scan_uri = NULL;
+    filter.scan_paths = delta->added;
+    filter.limit = 0;
+    filter.cursor = NULL;
+    if (filter.scan_types && g_RegisterCallback.binding_device_changed)
+        g_RegisterCallback.binding_device_changed(&filter);
+
+    g_hash_table_destroy(delta->added);
+    g_free(delta);
+}
+
+/*
+ * Files changed on an announced device: report the removed entries, have
+ * LMS scan the changed directories, then announce the new media only.
+ */
+static void media_device_files_changed(const MediaWatchChanges_t *changes)
+{
+    MediaDelta_t *delta;
+    gint scan_types;
+    gint i;
+
+    for (i = 0; changes->removed[i]; i++) {
+        gchar *uri = media_path_to_uri(changes->removed[i]);
+
+        if (g_RegisterCallback.binding_device_removed)
+            g_RegisterCallback.binding_device_removed(uri);
+        g_free(uri);
+    }
+
+    ListLock();
+    scan_types = MediaPlayerManage.filters.scan_types;
+    ListUnlock();
+
+    delta = g_malloc0(sizeof(*delta));
+    delta->added = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; changes->added[i]; i++)
+        g_hash_table_add(delta->added, g_strdup(changes->added[i]));
+
+    /* Held until every scan is requested, some may be over right away */
+    delta->pending = 1;
+    for (i = 0; changes->scan[i]; i++) {
+        delta->pending++;
+        media_scan_request(changes->scan[i], scan_types,
+                           media_delta_scanned, delta);
+    }
+    media_delta_scanned(NULL, delta);
+}
+
+/* Fallback when the mount table cannot be watched: entries of /media */
 void
 unmount_cb (GFileMonitor      *mon,
             GFile             *file,
@@ -285,37 +2021,13 @@ unmount_cb (GFileMonitor      *mon,
             gpointer           udata)
 {
     gchar *path = g_file_get_path(file);
-    gchar *uri = g_strconcat("file://", path, NULL);
-    gint ret = 0;
 
-    ListLock();
-    if (g_RegisterCallback.binding_device_removed &&
-        event == G_FILE_MONITOR_EVENT_DELETED) {
-
-        g_RegisterCallback.binding_device_removed(uri);
-        ret = sqlite3_close(scanDB.db);
-        /* TODO: Release SQLite connection handle resources on the end of each session
-        *
-        * we should be able to handle the SQLITE_BUSY return value safely
-        * and be sure the connection handle will be released finally at the end of session
-        * There are a few synchronous & asynchronous libsqlite methods
-        * to handle this situation properly.
-        */
-        if(ret == SQLITE_OK) {
-            scanDB.db = NULL;
-            scanDB.is_open = FALSE;
-        } else {
-            LOGE("Failed to release SQLite connection handle.\n");
-        }
-        g_free(path);
-    } else if (event == G_FILE_MONITOR_EVENT_CREATED) {
-        MediaPlayerManage.filters.scan_uri = path;
-    } else {
-        g_free(path);
-    }
+    if (event == G_FILE_MONITOR_EVENT_DELETED)
+        media_device_mount_changed(path, FALSE);
+    else if (event == G_FILE_MONITOR_EVENT_CREATED)
+        media_device_mount_changed(path, TRUE);
 
-    g_free(uri);
-    ListUnlock();
+    g_free(path);
 }
 
 /*
@@ -331,23 +2043,44 @@ int MediaPlayerManagerInit() {
     int ret;
 
     g_mutex_init(&(MediaPlayerManage.m));
-    scanDB.is_open = FALSE;
-    if(mon != NULL) {
-        g_object_unref(mon);
-        mon = NULL;
+    g_mutex_init(&scanDB.m);
+    g_queue_init(&scanDB.idle);
+
+    media_cache_init();
+    media_mounts_init();
+
+    if (media_mountinfo_init(media_device_mount_changed) < 0) {
+        LOGE("Falling back to watching /media entries\n");
+
+        if(mon != NULL) {
+            g_object_unref(mon);
+            mon = NULL;
+        }
+
+        file = g_file_new_for_path("/media");
+        g_assert(file != NULL);
+
+        mon = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        g_object_unref(file);
+        g_assert(mon != NULL);
+        g_signal_connect (mon, "changed", G_CALLBACK(unmount_cb), NULL);
+        MediaPlayerManage.mon = mon;
     }
 
-    file = g_file_new_for_path("/media");
-    g_assert(file != NULL);
+    ret = media_validator_init();
+    if (ret < 0)
+        return ret;
 
-    mon = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
-    g_object_unref(file);
-    g_assert(mon != NULL);
-    g_signal_connect (mon, "changed", G_CALLBACK(unmount_cb), NULL);
+    if (media_watch_init(media_device_files_changed) < 0)
+        LOGE("Changes on devices are left to LMS to find\n");
 
     ret = MediaPlayerDBusInit();
-    if (ret == 0)
+    if (ret == 0) {
+        media_scan_init(MediaPlayerManage.lms_proxy);
+        if (media_search_init() < 0)
+            LOGE("Search is not available\n");
         pthread_create(&thread_id, NULL, media_event_loop_thread, NULL);
+    }
     return ret;
 }
 
@@ -369,6 +2102,18 @@ void BindingAPIRegister(const Binding_RegisterCallback_t* pstRegisterCallback)
             g_RegisterCallback.binding_device_removed =
                 pstRegisterCallback->binding_device_removed;
         }
+
+        if (NULL != pstRegisterCallback->binding_device_progress)
+        {
+            g_RegisterCallback.binding_device_progress =
+                pstRegisterCallback->binding_device_progress;
+        }
+
+        if (NULL != pstRegisterCallback->binding_device_changed)
+        {
+            g_RegisterCallback.binding_device_changed =
+                pstRegisterCallback->binding_device_changed;
+        }
     }
 }
 
@@ -376,6 +2121,26 @@ void setAPIMediaListView(gint view) {
     MediaPlayerManage.filters.listview_type = view;
 }
 
+/* Report mounts below 'roots' of 'fstypes', NULL for the defaults */
+void setAPIMountSettings(const gchar * const *roots, const gchar * const *fstypes)
+{
+    media_mountinfo_configure(roots, fstypes);
+}
+
+/* Keep the search index in the file at 'path' */
+void setAPISearchIndex(const gchar *path)
+{
+    media_search_configure(path);
+}
+
+/* Tune the connections opened from now on */
+void setAPIDatabaseSettings(const MediaDBSettings_t *settings)
+{
+    g_mutex_lock(&scanDB.m);
+    scanDB.settings = *settings;
+    g_mutex_unlock(&scanDB.m);
+}
+
 gint ScanTypeAppend(gint type)
 {
     return MediaPlayerManage.filters.scan_types |= (type & LMS_ALL_SCAN);
@@ -390,10 +2155,13 @@ gint ScanTypeRemove(gint type)
 
 gint media_lists_get(MediaDevice_t* mdev, gchar **error)
 {
+    MediaDBConn_t *conn;
     MediaList_t *mlist = NULL;
     ScanFilter_t *filters = NULL;
-    gint ret = -1;
+    const MediaCursor_t *after = NULL;
+    gint ret = 0;
     gint scanned_media = 0;
+    gint first = LMS_MIN_ID;
     gint i = 0;
 
     if(!mdev)
@@ -403,26 +2171,55 @@ gint media_lists_get(MediaDevice_t* mdev, gchar **error)
     }
     filters = mdev->filters;
 
-    for( i = LMS_MIN_ID; i < LMS_SCAN_COUNT; ++i)
+    conn = media_db_acquire(error);
+    if(!conn)
+        return -1;
+
+    /* Categories are read in one read transaction, consistent together */
+    mdev->update_id = media_lms_update_id();
+    mdev->write_locked = media_lms_write_locked();
+    if(media_db_begin(conn, error) < 0)
+    {
+        media_db_release(conn);
+        return -1;
+    }
+
+    /* Categories are paged in order, resuming in the cursor's one */
+    if(filters->cursor)
+    {
+        after = filters->cursor;
+        first = after->scan_type_id;
+    }
+
+    for( i = LMS_MIN_ID; ret >= 0 && i < LMS_SCAN_COUNT; ++i)
     {
         if(filters->scan_types & (1 << i))
         {
             mlist = mdev->lists[i];
-            mlist->scan_type_str = lms_scan_types[i];
-            mlist->scan_type_id = i;
-
-            ret = media_lightmediascanner_scan(mlist,filters->scan_uri,error);
-            if(ret < 0){
-                return ret;
-            } else if(ret == 0){
-                free(mdev->lists[i]);
-                mdev->lists[i] = NULL;
+
+            if(i < first || mdev->next_cursor) {
+                ret = 0;
             } else {
+                ret = media_lightmediascanner_scan(mdev, conn, mlist,
+                        i == first ? after : NULL,
+                        filters->limit ? filters->limit - scanned_media : -1,
+                        error);
+            }
+
+            if(ret == 0){
+                media_list_free(mdev->lists[i]);
+                mdev->lists[i] = NULL;
+            } else if(ret > 0) {
                 scanned_media += ret;
             }
         }
     }
 
+    media_db_end(conn);
+    media_db_release(conn);
+    if(ret < 0)
+        return ret;
+
     LOGD("\n\tscanned media: %d\n",scanned_media);
     return scanned_media;
 }
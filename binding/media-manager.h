@@ -74,9 +74,72 @@ void DebugTraceSendMsg(int level, gchar* message);
 #define FREEDESKTOP_PROPERTIES      "org.freedesktop.DBus.Properties"
 
 //sqlite
-#define AUDIO_SQL_QUERY \
-                  "SELECT files.path, audios.title, audio_artists.name, " \
-                  "audio_albums.name, audio_genres.name, audios.length " \
+/*
+ * Every query selects the six media columns followed by its sort key.
+ * Parameters: [:prefix, :prefix_end) is the half-open range of paths under
+ * the scanned URI, which lets SQLite search the files.path index instead
+ * of scanning the table, :k0..:kN the sort key to resume after (the
+ * *_SQL_KEYSET fragment) and :limit the maximum number of rows. Sort key
+ * columns never hold NULL, so they can be compared as row values.
+ *
+ * No index holds the sort key, so SQLite reads every row of the range and
+ * sorts those past the keyset in a temporary B-tree, bounded to :limit
+ * rows. A page skips the cost of sending the rows before it, not the cost
+ * of reading them.
+ */
+#define MEDIA_SQL_KEY_COLUMN    6
+#define MEDIA_SQL_MAX_KEYS      4
+
+#define AUDIO_SQL_SORT_KEY \
+                  "IFNULL(audios.artist_id, 0), IFNULL(audios.album_id, 0), " \
+                  "IFNULL(audios.trackno, 0), files.id"
+
+#define AUDIO_SQL_KEYSET \
+                  "AND (" AUDIO_SQL_SORT_KEY ") > (:k0, :k1, :k2, :k3) "
+
+/*
+ * Conditions of a MediaMatch_t, each one holding when its parameter is
+ * NULL: :artist, :album and :genre names compared with NOCASE, :title a
+ * LIKE pattern and [:min_duration, :max_duration] a range in ms. Names
+ * are looked up through subqueries, so that they need no join.
+ */
+#define MEDIA_SQL_MATCH_TITLE_LENGTH(title, length) \
+                  "AND (:title IS NULL OR " title " LIKE :title ESCAPE '\\') " \
+                  "AND (:min_duration IS NULL OR " \
+                  "IFNULL(" length ", 0) * 1000 >= :min_duration) " \
+                  "AND (:max_duration IS NULL OR " \
+                  "IFNULL(" length ", 0) * 1000 <= :max_duration) "
+
+#define AUDIO_SQL_MATCH \
+                  "AND (:artist IS NULL OR audios.artist_id IN " \
+                  "(SELECT id FROM audio_artists " \
+                  "WHERE name = :artist COLLATE NOCASE)) " \
+                  "AND (:album IS NULL OR audios.album_id IN " \
+                  "(SELECT id FROM audio_albums " \
+                  "WHERE name = :album COLLATE NOCASE)) " \
+                  "AND (:genre IS NULL OR audios.genre_id IN " \
+                  "(SELECT id FROM audio_genres " \
+                  "WHERE name = :genre COLLATE NOCASE)) " \
+                  MEDIA_SQL_MATCH_TITLE_LENGTH("audios.title", "audios.length")
+
+#define VIDEO_SQL_MATCH \
+                  "AND (:artist IS NULL OR videos.artist = :artist COLLATE NOCASE) " \
+                  "AND :album IS NULL AND :genre IS NULL " \
+                  MEDIA_SQL_MATCH_TITLE_LENGTH("videos.title", "videos.length")
+
+#define IMAGE_SQL_MATCH \
+                  "AND :artist IS NULL AND :album IS NULL AND :genre IS NULL " \
+                  MEDIA_SQL_MATCH_TITLE_LENGTH("images.title", "0")
+
+/*
+ * *_SQL_QUERY_COLUMNS leave the title, artist, album, genre and length
+ * columns to the caller, so that media_result only reads the fields it
+ * reports, and take the conditions of a filter as 'match', an empty
+ * string for none. The artist, album and genre tables are then only
+ * joined when their name is selected, SQLite dropping unused LEFT JOINs
+ * on a primary key.
+ */
+#define AUDIO_SQL_FROM \
                   "FROM files INNER JOIN audios " \
                   "ON files.id = audios.id " \
                   "LEFT JOIN audio_artists " \
@@ -84,26 +147,257 @@ void DebugTraceSendMsg(int level, gchar* message);
                   "LEFT JOIN audio_albums " \
                   "ON audio_albums.id = audios.album_id " \
                   "LEFT JOIN audio_genres " \
-                  "ON audio_genres.id = audios.genre_id " \
-                  "WHERE files.path LIKE '%s/%%' " \
-                  "ORDER BY " \
-                  "audios.artist_id, audios.album_id, audios.trackno"
+                  "ON audio_genres.id = audios.genre_id "
+
+#define AUDIO_SQL_QUERY_COLUMNS(title, artist, album, genre, length, match) \
+                  "SELECT files.path, " title ", " artist ", " album ", " \
+                  genre ", " length ", " \
+                  AUDIO_SQL_SORT_KEY " " AUDIO_SQL_FROM \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  match AUDIO_SQL_KEYSET \
+                  "ORDER BY " AUDIO_SQL_SORT_KEY " " \
+                  "LIMIT :limit"
+
+#define AUDIO_SQL_QUERY \
+                  AUDIO_SQL_QUERY_COLUMNS("audios.title", "audio_artists.name", \
+                                          "audio_albums.name", "audio_genres.name", \
+                                          "audios.length", "")
+
+#define AUDIO_SQL_PATHS \
+                  AUDIO_SQL_QUERY_COLUMNS("NULL", "NULL", "NULL", "NULL", "0", "")
+
+#define AUDIO_SQL_QUERY_MATCH \
+                  AUDIO_SQL_QUERY_COLUMNS("audios.title", "audio_artists.name", \
+                                          "audio_albums.name", "audio_genres.name", \
+                                          "audios.length", AUDIO_SQL_MATCH)
+
+#define VIDEO_SQL_SORT_KEY \
+                  "IFNULL(videos.title, ''), files.id"
+
+#define VIDEO_SQL_KEYSET \
+                  "AND (" VIDEO_SQL_SORT_KEY ") > (:k0, :k1) "
+
+#define VIDEO_SQL_FROM \
+                  "FROM files INNER JOIN videos ON videos.id = files.id "
+
+#define VIDEO_SQL_QUERY_COLUMNS(title, artist, album, genre, length, match) \
+                  "SELECT files.path, " title ", " artist ", " album ", " \
+                  genre ", " length ", " VIDEO_SQL_SORT_KEY " " VIDEO_SQL_FROM \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  match VIDEO_SQL_KEYSET \
+                  "ORDER BY " VIDEO_SQL_SORT_KEY " " \
+                  "LIMIT :limit"
 
 #define VIDEO_SQL_QUERY \
-                  "SELECT files.path, videos.title, videos.artist, \"\", \"\", " \
-                  "videos.length FROM files " \
-                  "INNER JOIN videos ON videos.id = files.id " \
-                  "WHERE files.path LIKE '%s/%%' " \
-                  "ORDER BY " \
-                  "videos.title"
+                  VIDEO_SQL_QUERY_COLUMNS("videos.title", "videos.artist", \
+                                          "\"\"", "\"\"", "videos.length", "")
+
+#define IMAGE_SQL_SORT_KEY \
+                "IFNULL(images.title, ''), files.id"
+
+#define IMAGE_SQL_KEYSET \
+                "AND (" IMAGE_SQL_SORT_KEY ") > (:k0, :k1) "
+
+#define IMAGE_SQL_FROM \
+                "FROM files INNER JOIN images ON images.id = files.id "
+
+#define IMAGE_SQL_QUERY_COLUMNS(title, artist, album, genre, length, match) \
+                "SELECT files.path, " title ", " artist ", " album ", " \
+                genre ", " length ", " IMAGE_SQL_SORT_KEY " " IMAGE_SQL_FROM \
+                "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                match IMAGE_SQL_KEYSET \
+                "ORDER BY " IMAGE_SQL_SORT_KEY " " \
+                "LIMIT :limit"
 
 #define IMAGE_SQL_QUERY \
-                "SELECT files.path, images.title, \"\", \"\", " \
-                " \"\" FROM files " \
-                "INNER JOIN images ON images.id = files.id " \
-                "WHERE files.path LIKE '%s/%%' " \
-                "ORDER BY " \
-                "images.title"
+                IMAGE_SQL_QUERY_COLUMNS("images.title", "\"\"", "\"\"", \
+                                        "\"\"", "0", "")
+
+/*
+ * Media of one category LMS added in [:prefix, :prefix_end) after the
+ * file :after_id, in files.id order, followed by files.id. LMS numbers
+ * files in the order it adds them, so the files.id of the last row read
+ * is where the next read resumes while LMS is scanning.
+ */
+#define MEDIA_SQL_PROGRESS(columns, from) \
+                  "SELECT files.path, " columns ", files.id " from \
+                  "WHERE files.id > :after_id " \
+                  "AND files.path >= :prefix AND files.path < :prefix_end " \
+                  "ORDER BY files.id"
+
+#define AUDIO_SQL_PROGRESS \
+                  MEDIA_SQL_PROGRESS("audios.title, audio_artists.name, " \
+                                     "audio_albums.name, audio_genres.name, " \
+                                     "audios.length", AUDIO_SQL_FROM)
+
+#define VIDEO_SQL_PROGRESS \
+                  MEDIA_SQL_PROGRESS("videos.title, videos.artist, \"\", \"\", " \
+                                     "videos.length", VIDEO_SQL_FROM)
+
+#define IMAGE_SQL_PROGRESS \
+                  MEDIA_SQL_PROGRESS("images.title, \"\", \"\", \"\", 0", \
+                                     IMAGE_SQL_FROM)
+
+/*
+ * Media of one category in [:prefix, :prefix_end), in files.path order.
+ * That is the order of the index searched for the range, so SQLite needs
+ * no sort and returns the first row as soon as it is read: a device is
+ * streamed by stepping one statement across its whole range.
+ */
+#define MEDIA_SQL_STREAM(columns, from) \
+                  "SELECT files.path, " columns " " from \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  "ORDER BY files.path"
+
+#define AUDIO_SQL_STREAM \
+                  MEDIA_SQL_STREAM("audios.title, audio_artists.name, " \
+                                   "audio_albums.name, audio_genres.name, " \
+                                   "audios.length", AUDIO_SQL_FROM)
+
+#define VIDEO_SQL_STREAM \
+                  MEDIA_SQL_STREAM("videos.title, videos.artist, \"\", \"\", " \
+                                   "videos.length", VIDEO_SQL_FROM)
+
+#define IMAGE_SQL_STREAM \
+                  MEDIA_SQL_STREAM("images.title, \"\", \"\", \"\", 0", \
+                                   IMAGE_SQL_FROM)
+
+/*
+ * Media of one category in [:prefix, :prefix_end) LMS wrote after the
+ * UpdateID :since, files.update_id being the UpdateID of the scan that
+ * last wrote a file. No index holds files.update_id, but the other rows
+ * are left out before their category and names are read.
+ */
+#define MEDIA_SQL_CHANGED(columns, from) \
+                  "SELECT files.path, " columns " " from \
+                  "WHERE files.update_id > :since " \
+                  "AND files.path >= :prefix AND files.path < :prefix_end"
+
+#define AUDIO_SQL_CHANGED \
+                  MEDIA_SQL_CHANGED("audios.title, audio_artists.name, " \
+                                    "audio_albums.name, audio_genres.name, " \
+                                    "audios.length", AUDIO_SQL_FROM)
+
+#define VIDEO_SQL_CHANGED \
+                  MEDIA_SQL_CHANGED("videos.title, videos.artist, \"\", \"\", " \
+                                    "videos.length", VIDEO_SQL_FROM)
+
+#define IMAGE_SQL_CHANGED \
+                  MEDIA_SQL_CHANGED("images.title, \"\", \"\", \"\", 0", \
+                                    IMAGE_SQL_FROM)
+
+/* Paths of the media of one category in [:prefix, :prefix_end) */
+#define MEDIA_SQL_FILES(from) \
+                  "SELECT files.path " from \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end"
+
+#define AUDIO_SQL_FILES     MEDIA_SQL_FILES(AUDIO_SQL_FROM)
+#define VIDEO_SQL_FILES     MEDIA_SQL_FILES(VIDEO_SQL_FROM)
+#define IMAGE_SQL_FILES     MEDIA_SQL_FILES(IMAGE_SQL_FROM)
+
+/*
+ * Number, total length in seconds and latest files.update_id of the
+ * media of one category in [:prefix, :prefix_end). Only the files.path
+ * index range and the category table are read, no row is returned.
+ */
+#define AUDIO_SQL_SUMMARY \
+                  "SELECT COUNT(*), IFNULL(SUM(audios.length), 0), " \
+                  "IFNULL(MAX(files.update_id), 0) FROM files " \
+                  "INNER JOIN audios ON files.id = audios.id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end"
+
+#define VIDEO_SQL_SUMMARY \
+                  "SELECT COUNT(*), IFNULL(SUM(videos.length), 0), " \
+                  "IFNULL(MAX(files.update_id), 0) FROM files " \
+                  "INNER JOIN videos ON videos.id = files.id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end"
+
+#define IMAGE_SQL_SUMMARY \
+                  "SELECT COUNT(*), 0, " \
+                  "IFNULL(MAX(files.update_id), 0) FROM files " \
+                  "INNER JOIN images ON images.id = files.id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end"
+
+/*
+ * Audio library views of the tracks on one device, in the :prefix range
+ * of files.path: one row per artist, album or genre holding its name,
+ * the name of the album artist (albums only), the number of tracks,
+ * their total length in seconds and the id the tracks are grouped by.
+ * :artist, when not NULL, only counts the tracks of that artist. Rows of
+ * several devices are merged on that id by the caller, which also sorts
+ * them.
+ */
+#define BROWSE_SQL_ARTISTS \
+                  "SELECT audio_artists.name, NULL, COUNT(*), " \
+                  "IFNULL(SUM(audios.length), 0), audios.artist_id " \
+                  "FROM files INNER JOIN audios " \
+                  "ON audios.id = files.id " \
+                  "LEFT JOIN audio_artists " \
+                  "ON audio_artists.id = audios.artist_id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  "GROUP BY audios.artist_id"
+
+#define BROWSE_SQL_ALBUMS \
+                  "SELECT audio_albums.name, album_artists.name, COUNT(*), " \
+                  "IFNULL(SUM(audios.length), 0), audios.album_id " \
+                  "FROM files INNER JOIN audios " \
+                  "ON audios.id = files.id " \
+                  "LEFT JOIN audio_albums " \
+                  "ON audio_albums.id = audios.album_id " \
+                  "LEFT JOIN audio_artists AS album_artists " \
+                  "ON album_artists.id = audio_albums.artist_id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  "AND (:artist IS NULL OR audios.artist_id IN " \
+                  "(SELECT id FROM audio_artists " \
+                  "WHERE name = :artist COLLATE NOCASE)) " \
+                  "GROUP BY audios.album_id"
+
+#define BROWSE_SQL_GENRES \
+                  "SELECT audio_genres.name, NULL, COUNT(*), " \
+                  "IFNULL(SUM(audios.length), 0), audios.genre_id " \
+                  "FROM files INNER JOIN audios " \
+                  "ON audios.id = files.id " \
+                  "LEFT JOIN audio_genres " \
+                  "ON audio_genres.id = audios.genre_id " \
+                  "WHERE files.path >= :prefix AND files.path < :prefix_end " \
+                  "GROUP BY audios.genre_id"
+
+/*
+ * Tracks of the albums named :album on one device, in the :prefix range
+ * of files.path, optionally only those of :artist, in track order.
+ * Selects the first six columns of AUDIO_SQL_QUERY and reaches audios
+ * through its album_id index. BROWSE_SQL_TRACKS_COLUMNS leaves the
+ * columns to select to the caller: filters go through subqueries, so the
+ * artist, album and genre tables are only joined when their name is
+ * selected, SQLite dropping unused LEFT JOINs on a primary key.
+ */
+#define BROWSE_SQL_TRACKS_COLUMNS(title, artist, album, genre, length) \
+                  "SELECT files.path, " title ", " artist ", " album ", " \
+                  genre ", " length " " \
+                  "FROM audios INNER JOIN files " \
+                  "ON files.id = audios.id " \
+                  "LEFT JOIN audio_artists " \
+                  "ON audio_artists.id = audios.artist_id " \
+                  "LEFT JOIN audio_albums " \
+                  "ON audio_albums.id = audios.album_id " \
+                  "LEFT JOIN audio_genres " \
+                  "ON audio_genres.id = audios.genre_id " \
+                  "WHERE audios.album_id IN " \
+                  "(SELECT id FROM audio_albums " \
+                  "WHERE name = :album COLLATE NOCASE) " \
+                  "AND (:artist IS NULL OR audios.artist_id IN " \
+                  "(SELECT id FROM audio_artists " \
+                  "WHERE name = :artist COLLATE NOCASE)) " \
+                  "AND files.path >= :prefix AND files.path < :prefix_end " \
+                  "ORDER BY IFNULL(audios.trackno, 0), files.id"
+
+#define BROWSE_SQL_TRACKS \
+                  BROWSE_SQL_TRACKS_COLUMNS("audios.title", "audio_artists.name", \
+                                            "audio_albums.name", "audio_genres.name", \
+                                            "audios.length")
+
+#define BROWSE_SQL_TRACK_PATHS \
+                  BROWSE_SQL_TRACKS_COLUMNS("NULL", "NULL", "NULL", "NULL", "0")
 
 enum {
     LMS_MIN_ID = 0,
@@ -131,10 +425,54 @@ extern const char *lms_scan_types[LMS_SCAN_COUNT];
 
 #define SCAN_URI_DEFAULT NULL
 
+/*
+ * Position in a paginated scan: the category the next page starts in and
+ * the sort key of the last item returned from it (n_keys == 0 means the
+ * start of the category).
+ */
+typedef struct {
+    gint scan_type_id;
+    gint n_keys;
+    struct {
+        gboolean is_text;
+        gint64 num;
+        gchar *text;
+    } keys[MEDIA_SQL_MAX_KEYS];
+} MediaCursor_t;
+
+/*
+ * Conditions on media metadata, all of which must hold, evaluated by
+ * SQLite (see *_SQL_MATCH). Text is compared ignoring ASCII case.
+ */
+typedef struct {
+    gchar *artist;          /* equal to, or NULL */
+    gchar *album;           /* equal to, or NULL */
+    gchar *genre;           /* equal to, or NULL */
+    gchar *title;           /* starting with, or NULL */
+    gint min_duration;      /* in ms, inclusive, or -1 */
+    gint max_duration;      /* in ms, inclusive, or -1 */
+} MediaMatch_t;
+
+/* Item fields reported to a client, the path always is */
+#define MEDIA_FIELD_PATH        (1 << 0)
+#define MEDIA_FIELD_TYPE        (1 << 1)
+#define MEDIA_FIELD_TITLE       (1 << 2)
+#define MEDIA_FIELD_ARTIST      (1 << 3)
+#define MEDIA_FIELD_ALBUM       (1 << 4)
+#define MEDIA_FIELD_GENRE       (1 << 5)
+#define MEDIA_FIELD_DURATION    (1 << 6)
+#define MEDIA_FIELD_ALL         ((1 << 7) - 1)
+
 typedef struct {
     gint listview_type;
     gint scan_types;
     gchar *scan_uri;
+    GHashTable *scan_paths; /* only media at or below these paths, or
+                               NULL for all */
+    gint limit;             /* max items per scan, 0 for no limit */
+    MediaCursor_t *cursor;  /* resume after this position, or NULL */
+    MediaMatch_t *match;    /* only media matching, or NULL for all */
+    gint fields;            /* MEDIA_FIELD_* to report, 0 for all */
 }ScanFilter_t;
 
 typedef struct {
@@ -145,32 +483,51 @@ typedef struct {
 } stMediaPlayerManage;
 
 
+/*
+ * Item strings are not owned by the item: they live in the arena of the
+ * MediaDevice_t the item was scanned into and are released together with it.
+ */
 typedef struct {
-    gchar *path;
+    const gchar *path;
     struct {
-        gchar *title;
-        gchar *artist;
-        gchar *album;
-        gchar *genre;
+        const gchar *title;
+        const gchar *artist;
+        const gchar *album;
+        const gchar *genre;
         gint  duration;
     } metadata;
 }MediaItem_t;
 
 typedef struct {
-    GList *list;
-    gchar* scan_type_str;
+    GArray *items;  /* contiguous array of MediaItem_t */
+    const gchar* scan_type_str;
     gint scan_type_id;
 } MediaList_t;
 
+/* Initial chunk size of the per-scan string arena */
+#define MEDIA_ARENA_CHUNK_SIZE  (64 * 1024)
+/* Initial capacity of each per-category item array */
+#define MEDIA_LIST_PREALLOC     256
+
 typedef struct {
     MediaList_t *lists[LMS_SCAN_COUNT];
+    GStringChunk *arena;
     ScanFilter_t *filters;
+    MediaCursor_t *next_cursor; /* set when 'limit' cut the scan short */
+    guint64 update_id;          /* LMS UpdateID when the scan started */
+    gboolean write_locked;      /* LMS was writing when the scan started */
 } MediaDevice_t;
 
 typedef struct tagBinding_RegisterCallback
 {
     void (*binding_device_added)(ScanFilter_t *filters);
     void (*binding_device_removed)(const char *obj_path);
+    /* media of 'mdev' committed by LMS while still scanning the device
+       mounted at 'device', owned by the caller */
+    void (*binding_device_progress)(MediaDevice_t *mdev, const char *device);
+    /* media at or below 'filters->scan_paths' changed on a device
+       already announced */
+    void (*binding_device_changed)(ScanFilter_t *filters);
 } Binding_RegisterCallback_t;
 
 /* ------ PUBLIC PLUGIN FUNCTIONS --------- */
@@ -181,10 +538,276 @@ gint ScanTypeAppend(gint);
 gint ScanTypeRemove(gint);
 void setAPIMediaListView(gint view);
 
+/* Threads computing media_result replies */
+#define MEDIA_WORKER_THREADS    4
+/*
+ * Idle read-only connections kept open for reuse: one per thread reading
+ * LMS at once, i.e. the media_result workers, the event loop announcing
+ * media and the search index sync, so that none of them has to open a
+ * connection and prepare its statements again.
+ */
+#define MEDIA_DB_POOL_SIZE      (MEDIA_WORKER_THREADS + 2)
+/* Default connection tuning: 64 MiB mapped, 8 MiB page cache, memory temp */
+#define MEDIA_DB_MMAP_SIZE      (64 * 1024 * 1024)
+#define MEDIA_DB_CACHE_SIZE     (-8192)
+#define MEDIA_DB_TEMP_STORE     2
+/* Milliseconds a query waits for LMS to release its write lock */
+#define MEDIA_DB_BUSY_TIMEOUT   200
+
+/* PRAGMA values applied to every database connection */
+typedef struct {
+    gint64 mmap_size;   /* bytes of the file accessed through mmap() */
+    gint cache_size;    /* pages, or KiB when negative */
+    gint temp_store;    /* 0 default, 1 file, 2 memory */
+} MediaDBSettings_t;
+
+void setAPIDatabaseSettings(const MediaDBSettings_t *settings);
+void setAPIMountSettings(const gchar * const *roots, const gchar * const *fstypes);
+void setAPISearchIndex(const gchar *path);
+
+/* Replies handed to afb pre-serialized, expanded for in-process readers */
+struct json_object;
+struct json_object *media_json_expand(struct json_object *jso);
+
+/* Called on the manager event loop when a device is mounted or unmounted */
+typedef void (*MediaMountinfoFunc)(const gchar *path, gboolean mounted);
+
+void media_mountinfo_configure(const gchar * const *roots,
+                               const gchar * const *fstypes);
+int media_mountinfo_init(MediaMountinfoFunc func);
+
+/* Targeted LMS scans, 'error' is NULL once the scan is done */
+typedef void (*MediaScanFunc)(const gchar *error, gpointer data);
+
+/* Seconds LMS has to start scanning once it accepted a Scan call */
+#define MEDIA_SCAN_START_TIMEOUT 30
+
+typedef struct {
+    gint requests;      /* scans requested */
+    gint merged;        /* requests merged into another one */
+    gint issued;        /* Scanner1.Scan calls */
+    gint refused;       /* Scanner1.Scan calls LMS refused */
+} MediaScanStats_t;
+
+void media_scan_init(Scanner1 *proxy);
+void media_scan_request(const gchar *path, gint scan_types,
+                        MediaScanFunc func, gpointer data);
+void media_scan_stats(MediaScanStats_t *stats);
+void media_scan_cancel(const gchar *path);
+void media_scan_lms_idle(void);
+void media_scan_lms_scanning(void);
+gboolean media_scan_path_allowed(const gchar *path);
+
+/* Live change tracking on announced devices (see media-watch.c) */
+#define MEDIA_WATCH_MAX         4096    /* inotify watches, all devices */
+#define MEDIA_WATCH_DEBOUNCE    1000    /* ms without changes before reporting */
+#define MEDIA_WATCH_DELTA_MAX   256     /* entries reported one by one */
+
+typedef struct {
+    gchar **scan;       /* directories to scan again */
+    gchar **added;      /* media at or below these may be new */
+    gchar **removed;    /* entries deleted or moved away */
+} MediaWatchChanges_t;
+
+typedef struct {
+    gint watches;       /* directories watched */
+    gint overflows;     /* times the kernel dropped events */
+    gint truncated;     /* times the watch budget ran out */
+} MediaWatchStats_t;
+
+/* Called on the manager event loop with the changes on watched devices */
+typedef void (*MediaWatchFunc)(const MediaWatchChanges_t *changes);
+
+int media_watch_init(MediaWatchFunc func);
+void media_watch_add(const gchar *root);
+void media_watch_remove(const gchar *root);
+void media_watch_stats(MediaWatchStats_t *stats);
+
+/* Full-text search (see media-search.c) */
+#define MEDIA_SEARCH_LIMIT      50      /* hits when no limit is given */
+
+/* Hit strings live in the arena of the result */
+typedef struct {
+    gint scan_type_id;
+    MediaItem_t item;
+} MediaSearchHit_t;
+
+typedef struct {
+    GArray *hits;           /* MediaSearchHit_t, best first */
+    GStringChunk *arena;
+} MediaSearchResult_t;
+
+void media_search_configure(const gchar *path);
+int media_search_init(void);
+void media_search_update(void);
+MediaSearchResult_t *media_search(const gchar *text, gint scan_types,
+                                  gint limit, gchar **error);
+void media_search_result_free(MediaSearchResult_t *result);
+
+/* Audio library browsing, see the BROWSE_SQL_* queries */
+typedef enum {
+    MEDIA_BROWSE_ARTISTS = 0,
+    MEDIA_BROWSE_ALBUMS,
+    MEDIA_BROWSE_GENRES,
+    MEDIA_BROWSE_COUNT
+} MediaBrowseView_t;
+
+/* Row strings live in the arena of the result */
+typedef struct {
+    gint64 id;              /* artist, album or genre id, 0 for none */
+    const gchar *name;      /* NULL for tracks without one */
+    const gchar *artist;    /* album artist, or NULL */
+    gint count;             /* tracks */
+    gint64 duration;        /* total, in ms */
+} MediaBrowseRow_t;
+
+typedef struct {
+    GArray *rows;           /* MediaBrowseRow_t by name, or NULL */
+    GArray *items;          /* MediaItem_t in track order per device, or NULL */
+    GStringChunk *arena;
+} MediaBrowseResult_t;
+
+MediaBrowseResult_t *media_browse(MediaBrowseView_t view, const gchar *artist,
+                                  const gchar *device, gchar **error);
+MediaBrowseResult_t *media_browse_tracks(const gchar *album,
+                                         const gchar *artist,
+                                         const gchar *device, gint fields,
+                                         gchar **error);
+void media_browse_result_free(MediaBrowseResult_t *result);
+
+/* Media of one category on a device, see media_summary() */
+typedef struct {
+    gint count;
+    gint64 duration;        /* total, in ms */
+    guint64 update_id;      /* UpdateID of the latest change, 0 if none */
+} MediaSummaryCount_t;
+
+typedef struct {
+    gchar *path;            /* mount path */
+    MediaSummaryCount_t counts[LMS_SCAN_COUNT];
+} MediaSummaryDevice_t;
+
+typedef struct {
+    guint64 update_id;      /* LMS UpdateID when the counts were read */
+    GArray *devices;        /* MediaSummaryDevice_t by path */
+} MediaSummary_t;
+
+MediaSummary_t *media_summary(const gchar *device, gchar **error);
+void media_summary_free(MediaSummary_t *summary);
+
 void ListLock();
 void ListUnlock();
 
+MediaDevice_t *media_device_new(ScanFilter_t *filters);
 gint media_lists_get(MediaDevice_t* mdev, gchar **error);
+gboolean media_device_is_stale(MediaDevice_t *mdev);
+gint media_device_count(MediaDevice_t *mdev);
+gint media_device_drop_seen(MediaDevice_t *mdev, GHashTable *seen);
 void media_device_free(MediaDevice_t *mdev);
 
+/* Called with each chunk of a device, see media_device_stream() */
+typedef void (*MediaChunkFunc)(MediaDevice_t *mdev, gint items,
+                               gboolean complete, gpointer data);
+gint media_device_stream(MediaDevice_t *mdev, gint chunk_size, GHashTable *seen,
+                         MediaChunkFunc func, gpointer data, gchar **error);
+
+gchar *media_cursor_encode(const MediaCursor_t *cursor);
+MediaCursor_t *media_cursor_decode(const gchar *str);
+/* Called with media of the catalogue, see media_catalogue_foreach() */
+typedef void (*MediaEntryFunc)(gint scan_type_id, const gchar *file,
+                               const MediaItem_t *item, gpointer data);
+/* Called with every file of the catalogue, see media_catalogue_files() */
+typedef void (*MediaFileFunc)(const gchar *file, gpointer data);
+
+gint media_catalogue_foreach(MediaEntryFunc func, gpointer data, gint64 since,
+                             gint64 *update_id, gint *count, gchar **error);
+gint media_catalogue_files(MediaFileFunc func, gpointer data, gchar **error);
+
+void media_cursor_free(MediaCursor_t *cursor);
+void media_match_free(MediaMatch_t *match);
+
+/* Maximum number of paths the validator checks in one go */
+#define MEDIA_VALIDATOR_BATCH   64
+/* Maximum number of paths the validator keeps a verdict for */
+#define MEDIA_VALIDATOR_MAX_PATHS   65536
+
+int media_validator_init(void);
+gboolean media_validator_is_valid(const gchar *path);
+void media_validator_device_added(const gchar *root);
+void media_validator_device_removed(const gchar *root);
+void media_validator_reset(void);
+
+typedef enum {
+    MEDIA_MOUNT_MOUNTED = 0,    /* seen below /media, not indexed yet */
+    MEDIA_MOUNT_INDEXING,       /* LMS reported progress on it */
+    MEDIA_MOUNT_READY,          /* indexed and announced */
+    MEDIA_MOUNT_REMOVED,
+} MediaMountState_t;
+
+typedef struct {
+    gchar *path;                /* mount path, e.g. /media/sda1 */
+    MediaMountState_t state;
+    gboolean indexed;           /* LMS indexed it since it was mounted */
+    gint64 mounted;             /* real time of the last mount, in us */
+    gint64 ready;               /* real time it became READY, 0 before */
+    guint64 events;             /* media_added events sent for it */
+    guint64 media;              /* media announced by those events */
+    GHashTable *announced;      /* URIs announced while INDEXING */
+} MediaMount_t;
+
+typedef void (*MediaMountFunc)(const MediaMount_t *mount, gpointer data);
+
+void media_mounts_init(void);
+const gchar *media_mount_state_name(MediaMountState_t state);
+void media_mount_added(const gchar *path);
+void media_mount_removed(const gchar *path);
+gchar **media_mount_indexing(const gchar *path);
+void media_mount_indexed(const gchar *path);
+void media_mounts_scanned(void);
+gchar **media_mounts_pending(void);
+void media_mount_ready(const gchar *path);
+gboolean media_mount_is_mounted(const gchar *path);
+gboolean media_mount_contains(const gchar *path);
+GHashTable *media_mount_announced(const gchar *path);
+void media_mount_account(const gchar *path, guint media);
+void media_mounts_foreach(MediaMountFunc func, gpointer data);
+
+/* Milliseconds without PropertiesChanged before refreshing after LMS */
+#define MEDIA_REFRESH_DEBOUNCE  250
+
+typedef struct {
+    guint signals;      /* PropertiesChanged received */
+    guint coalesced;    /* refreshes merged into a later one */
+    guint unchanged;    /* refreshes skipped, UpdateID did not advance */
+    guint refreshes;    /* refreshes run */
+} MediaRefreshStats_t;
+
+void media_refresh_stats(MediaRefreshStats_t *stats);
+
+/* Bytes of serialized replies the response cache may hold */
+#define MEDIA_CACHE_MAX_SIZE    (4*1024*1024)
+
+guint64 media_lms_update_id(void);
+
+void media_cache_init(void);
+gchar *media_cache_key(const ScanFilter_t *filter);
+GBytes *media_cache_lookup(const gchar *key, guint *generation);
+void media_cache_insert(const gchar *key, guint generation, GBytes *bytes);
+void media_cache_invalidate(void);
+
+typedef enum {
+    MEDIA_STAT_SERIAL = 0,  /* blocking stat() one path after the other */
+    MEDIA_STAT_THREADS,     /* blocking stat() on a pool of threads */
+    MEDIA_STAT_URING,       /* statx requests batched through io_uring */
+} MediaStatBackend_t;
+
+typedef struct _MediaStatBatch MediaStatBatch_t;
+
+MediaStatBatch_t *media_stat_batch_new(MediaStatBackend_t backend);
+MediaStatBackend_t media_stat_batch_backend(MediaStatBatch_t *batch);
+const gchar *media_stat_backend_name(MediaStatBackend_t backend);
+void media_stat_batch_check(MediaStatBatch_t *batch, gchar **paths,
+                            gboolean *exists, guint n);
+void media_stat_batch_free(MediaStatBatch_t *batch);
+
 #endif
\ No newline at end of file
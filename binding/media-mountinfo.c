@@ -0,0 +1,240 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Mount detection
+ *
+ * The kernel flags /proc/self/mountinfo with EPOLLPRI whenever the mount
+ * table changes. A thread waits for that, reads the table again and
+ * compares the mounts of removable media filesystems below the mount
+ * roots with the previous ones. Changes are reported on the manager
+ * event loop once the mount is complete, rather than when its directory
+ * gets created.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+
+static const gchar * const default_roots[] = { "/media", NULL };
+static const gchar * const default_fstypes[] = {
+    "vfat", "exfat", "ntfs", "ntfs3", "fuseblk", "ext2", "ext3", "ext4",
+    "hfsplus", "iso9660", "udf", NULL
+};
+
+typedef struct {
+    gchar *path;
+    gboolean mounted;
+} MountChange_t;
+
+static struct {
+    gchar **roots;          /* only mounts at or below these are reported */
+    gchar **fstypes;        /* only mounts of these filesystems are */
+    GHashTable *mounts;     /* mount points reported as mounted */
+    MediaMountinfoFunc func;
+    int fd;
+    int epfd;
+    GThread *thread;
+} mountinfo = { .fd = -1, .epfd = -1 };
+
+static gboolean mount_is_below_root(const gchar *path)
+{
+    gint i;
+
+    for (i = 0; mountinfo.roots[i]; i++) {
+        const gsize len = strlen(mountinfo.roots[i]);
+
+        if (strncmp(path, mountinfo.roots[i], len) == 0 &&
+            (path[len] == '\0' || path[len] == '/'))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Mount points of the filesystems to report, from mountinfo lines like
+ * "36 35 98:0 / /media/sda1 rw,noatime shared:1 - vfat /dev/sda1 rw".
+ * Mount points escape blanks and backslashes as octal sequences.
+ */
+static GHashTable *mountinfo_read(void)
+{
+    GHashTable *mounts = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, NULL);
+    GString *buf = g_string_sized_new(4096);
+    gchar chunk[4096];
+    gchar **lines;
+    ssize_t len;
+    gint i, j;
+
+    if (lseek(mountinfo.fd, 0, SEEK_SET) < 0)
+        goto out;
+    while ((len = read(mountinfo.fd, chunk, sizeof(chunk))) > 0)
+        g_string_append_len(buf, chunk, len);
+
+    lines = g_strsplit(buf->str, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        gchar **fields = g_strsplit(lines[i], " ", -1);
+
+        /* Optional fields end with "-", followed by the filesystem type */
+        for (j = 6; fields[0] && j < (gint) g_strv_length(fields) - 1; j++) {
+            if (strcmp(fields[j], "-") == 0) {
+                gchar *path = g_strcompress(fields[4]);
+
+                if (g_strv_contains((const gchar * const *) mountinfo.fstypes,
+                                    fields[j + 1]) &&
+                    mount_is_below_root(path))
+                    g_hash_table_add(mounts, path);
+                else
+                    g_free(path);
+                break;
+            }
+        }
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+
+out:
+    g_string_free(buf, TRUE);
+    return mounts;
+}
+
+static gboolean mountinfo_report(gpointer data)
+{
+    MountChange_t *change = data;
+
+    mountinfo.func(change->path, change->mounted);
+    g_free(change->path);
+    g_free(change);
+    return G_SOURCE_REMOVE;
+}
+
+static void mountinfo_post(const gchar *path, gboolean mounted)
+{
+    MountChange_t *change = g_malloc0(sizeof(*change));
+
+    LOGD("%s %s\n", path, mounted ? "mounted" : "unmounted");
+    change->path = g_strdup(path);
+    change->mounted = mounted;
+    g_idle_add(mountinfo_report, change);
+}
+
+/* Report the differences with the previous mount table */
+static void mountinfo_update(void)
+{
+    GHashTable *mounts = mountinfo_read();
+    GHashTableIter iter;
+    gpointer path;
+
+    g_hash_table_iter_init(&iter, mountinfo.mounts);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        if (!g_hash_table_contains(mounts, path))
+            mountinfo_post(path, FALSE);
+    }
+
+    g_hash_table_iter_init(&iter, mounts);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        if (!g_hash_table_contains(mountinfo.mounts, path))
+            mountinfo_post(path, TRUE);
+    }
+
+    g_hash_table_destroy(mountinfo.mounts);
+    mountinfo.mounts = mounts;
+}
+
+static void *mountinfo_thread(void *unused)
+{
+    struct epoll_event ev;
+    int ret;
+
+    for (;;) {
+        ret = epoll_wait(mountinfo.epfd, &ev, 1, -1);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            LOGE("Cannot wait for mount changes: %s\n", g_strerror(errno));
+            break;
+        }
+        mountinfo_update();
+    }
+
+    return NULL;
+}
+
+/*
+ * Report mounts at or below 'roots' of filesystems in 'fstypes' (NULL
+ * terminated, NULL for the defaults). Must be called before init.
+ */
+void media_mountinfo_configure(const gchar * const *roots,
+                               const gchar * const *fstypes)
+{
+    g_strfreev(mountinfo.roots);
+    g_strfreev(mountinfo.fstypes);
+    mountinfo.roots = g_strdupv((gchar **) (roots ? roots : default_roots));
+    mountinfo.fstypes = g_strdupv((gchar **) (fstypes ? fstypes : default_fstypes));
+}
+
+/*
+ * Start watching the mount table. 'func' is called on the default main
+ * context for every mount found at startup, then for every change.
+ */
+int media_mountinfo_init(MediaMountinfoFunc func)
+{
+    struct epoll_event ev = { .events = EPOLLPRI | EPOLLERR };
+
+    if (!mountinfo.roots)
+        media_mountinfo_configure(NULL, NULL);
+    mountinfo.func = func;
+    mountinfo.mounts = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+
+    mountinfo.fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+    if (mountinfo.fd < 0) {
+        LOGE("Cannot open %s: %s\n", MOUNTINFO_PATH, g_strerror(errno));
+        return -1;
+    }
+
+    mountinfo.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (mountinfo.epfd < 0 ||
+        epoll_ctl(mountinfo.epfd, EPOLL_CTL_ADD, mountinfo.fd, &ev) < 0) {
+        LOGE("Cannot watch %s: %s\n", MOUNTINFO_PATH, g_strerror(errno));
+        goto fail;
+    }
+
+    mountinfo_update();
+
+    mountinfo.thread = g_thread_try_new("media-mountinfo", mountinfo_thread,
+                                        NULL, NULL);
+    if (!mountinfo.thread) {
+        LOGE("Cannot start the mount detection thread\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (mountinfo.epfd >= 0)
+        close(mountinfo.epfd);
+    close(mountinfo.fd);
+    mountinfo.epfd = mountinfo.fd = -1;
+    return -1;
+}
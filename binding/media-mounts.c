@@ -0,0 +1,299 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Mounted device registry
+ *
+ * Every storage device seen below /media is tracked by its mount path,
+ * through the states:
+ *
+ *   MOUNTED  -> INDEXING -> READY -> REMOVED
+ *      \__________________________/
+ *
+ * A device is announced with media_added once, when LMS is done indexing
+ * it: once the scan requested for it is over, or once LMS is idle again
+ * after reporting progress on it. Devices already READY are left alone
+ * when another one comes.
+ * Removed devices are kept, so that their statistics remain available
+ * and a device mounted again starts over from MOUNTED.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+static const gchar *mount_state_names[] = {
+    [MEDIA_MOUNT_MOUNTED]  = "mounted",
+    [MEDIA_MOUNT_INDEXING] = "indexing",
+    [MEDIA_MOUNT_READY]    = "ready",
+    [MEDIA_MOUNT_REMOVED]  = "removed",
+};
+
+static struct {
+    GMutex m;
+    GHashTable *mounts;     /* path -> MediaMount_t */
+} registry = { 0 };
+
+static void media_mount_free(MediaMount_t *mount)
+{
+    g_hash_table_destroy(mount->announced);
+    g_free(mount->path);
+    g_free(mount);
+}
+
+/* Mount owning 'path', i.e. mounted at or above it, or NULL */
+static MediaMount_t *media_mount_find(const gchar *path)
+{
+    GHashTableIter iter;
+    MediaMount_t *mount;
+
+    g_hash_table_iter_init(&iter, registry.mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount)) {
+        const gsize len = strlen(mount->path);
+
+        if (mount->state != MEDIA_MOUNT_REMOVED &&
+            strncmp(path, mount->path, len) == 0 &&
+            (path[len] == '\0' || path[len] == '/'))
+            return mount;
+    }
+    return NULL;
+}
+
+const gchar *media_mount_state_name(MediaMountState_t state)
+{
+    return mount_state_names[state];
+}
+
+void media_mount_added(const gchar *path)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    if (!mount) {
+        mount = g_malloc0(sizeof(*mount));
+        mount->path = g_strdup(path);
+        mount->announced = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 g_free, NULL);
+        g_hash_table_insert(registry.mounts, mount->path, mount);
+    }
+    mount->state = MEDIA_MOUNT_MOUNTED;
+    mount->indexed = FALSE;
+    mount->mounted = g_get_real_time();
+    mount->ready = 0;
+    g_hash_table_remove_all(mount->announced);
+    g_mutex_unlock(&registry.m);
+}
+
+void media_mount_removed(const gchar *path)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    if (mount) {
+        mount->state = MEDIA_MOUNT_REMOVED;
+        g_hash_table_remove_all(mount->announced);
+    }
+    g_mutex_unlock(&registry.m);
+}
+
+static gboolean media_mount_is_pending(const MediaMount_t *mount)
+{
+    return mount->state == MEDIA_MOUNT_MOUNTED ||
+           mount->state == MEDIA_MOUNT_INDEXING;
+}
+
+/*
+ * LMS is indexing 'path': return the mount paths of the devices yet to
+ * be announced it covers, NULL terminated. That is the device 'path' is
+ * on, or when 'path' is a directory holding mount points, such as an LMS
+ * root like /media, the devices mounted below it.
+ */
+gchar **media_mount_indexing(const gchar *path)
+{
+    GPtrArray *devices = g_ptr_array_new();
+    GHashTableIter iter;
+    MediaMount_t *mount;
+    gsize len;
+
+    g_mutex_lock(&registry.m);
+    mount = media_mount_find(path);
+    if (mount) {
+        if (media_mount_is_pending(mount)) {
+            mount->state = MEDIA_MOUNT_INDEXING;
+            g_ptr_array_add(devices, g_strdup(mount->path));
+        }
+    } else {
+        len = strlen(path);
+        while (len > 1 && path[len - 1] == '/')
+            len--;
+        g_hash_table_iter_init(&iter, registry.mounts);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount)) {
+            if (media_mount_is_pending(mount) &&
+                strncmp(mount->path, path, len) == 0 &&
+                (mount->path[len] == '/' || (len == 1 && path[0] == '/'))) {
+                mount->state = MEDIA_MOUNT_INDEXING;
+                g_ptr_array_add(devices, g_strdup(mount->path));
+            }
+        }
+    }
+    g_mutex_unlock(&registry.m);
+
+    g_ptr_array_add(devices, NULL);
+    return (gchar **) g_ptr_array_free(devices, FALSE);
+}
+
+/* The scan requested for the device mounted at 'path' is over */
+void media_mount_indexed(const gchar *path)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    if (mount && media_mount_is_pending(mount))
+        mount->indexed = TRUE;
+    g_mutex_unlock(&registry.m);
+}
+
+/* LMS is idle again: the devices it reported progress on are indexed */
+void media_mounts_scanned(void)
+{
+    GHashTableIter iter;
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    g_hash_table_iter_init(&iter, registry.mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount)) {
+        if (mount->state == MEDIA_MOUNT_INDEXING)
+            mount->indexed = TRUE;
+    }
+    g_mutex_unlock(&registry.m);
+}
+
+/*
+ * Mount paths of the devices LMS indexed and that are yet to be
+ * announced, NULL terminated
+ */
+gchar **media_mounts_pending(void)
+{
+    GPtrArray *pending = g_ptr_array_new();
+    GHashTableIter iter;
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    g_hash_table_iter_init(&iter, registry.mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount)) {
+        if (media_mount_is_pending(mount) && mount->indexed)
+            g_ptr_array_add(pending, g_strdup(mount->path));
+    }
+    g_mutex_unlock(&registry.m);
+
+    g_ptr_array_add(pending, NULL);
+    return (gchar **) g_ptr_array_free(pending, FALSE);
+}
+
+void media_mount_ready(const gchar *path)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    if (mount && mount->state != MEDIA_MOUNT_REMOVED) {
+        mount->state = MEDIA_MOUNT_READY;
+        mount->ready = g_get_real_time();
+        g_hash_table_remove_all(mount->announced);
+    }
+    g_mutex_unlock(&registry.m);
+}
+
+/* Whether 'path' is the mount path of a device currently mounted */
+gboolean media_mount_is_mounted(const gchar *path)
+{
+    MediaMount_t *mount;
+    gboolean ret;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    ret = mount && mount->state != MEDIA_MOUNT_REMOVED;
+    g_mutex_unlock(&registry.m);
+
+    return ret;
+}
+
+/* Whether 'path' is at or below a mounted device */
+gboolean media_mount_contains(const gchar *path)
+{
+    gboolean ret;
+
+    g_mutex_lock(&registry.m);
+    ret = media_mount_find(path) != NULL;
+    g_mutex_unlock(&registry.m);
+
+    return ret;
+}
+
+/*
+ * Media of the device mounted at 'path' announced while it was indexed,
+ * or NULL. The set belongs to the registry and must only be used from
+ * the manager event loop, which is where devices get removed.
+ */
+GHashTable *media_mount_announced(const gchar *path)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    g_mutex_unlock(&registry.m);
+
+    return mount ? mount->announced : NULL;
+}
+
+/* Account one media_added event of 'media' items for the device */
+void media_mount_account(const gchar *path, guint media)
+{
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    mount = g_hash_table_lookup(registry.mounts, path);
+    if (mount) {
+        mount->events++;
+        mount->media += media;
+    }
+    g_mutex_unlock(&registry.m);
+}
+
+/* Call 'func' on every device, with the registry locked */
+void media_mounts_foreach(MediaMountFunc func, gpointer data)
+{
+    GHashTableIter iter;
+    MediaMount_t *mount;
+
+    g_mutex_lock(&registry.m);
+    g_hash_table_iter_init(&iter, registry.mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount))
+        func(mount, data);
+    g_mutex_unlock(&registry.m);
+}
+
+void media_mounts_init(void)
+{
+    g_mutex_init(&registry.m);
+    registry.mounts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify) media_mount_free);
+}
@@ -0,0 +1,429 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Targeted LMS scans
+ *
+ * Left alone, LMS goes through every configured directory and category
+ * when a device shows up. Instead, Scanner1.Scan is called with a
+ * specification mapping each category to the paths to scan in it, so
+ * that only the new device is read, and only for the media subscribers
+ * asked for.
+ *
+ * Clients may also ask for a subtree to be scanned again (rescan verb).
+ *
+ * LMS runs one scan at a time. Requests made meanwhile are kept and
+ * merged into a single Scan call once LMS is idle again, overlapping
+ * paths being scanned once. A request never joins the Scan in flight:
+ * LMS may already be past the files it is about. A Scan is over once
+ * LMS has been seen scanning and reports it is idle again. It fails when
+ * LMS leaves the bus or restarts before that, or when LMS is not seen
+ * scanning within MEDIA_SCAN_START_TIMEOUT, unless its UpdateID changed
+ * meanwhile. Everything but media_scan_request() and
+ * media_scan_path_allowed() runs on the manager event loop.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+static const struct {
+    gint scan_type;
+    const gchar *category;
+} scan_categories[] = {
+    { LMS_AUDIO_SCAN, "audio" },
+    { LMS_VIDEO_SCAN, "video" },
+    { LMS_IMAGE_SCAN, "picture" },
+};
+
+typedef struct {
+    MediaScanFunc func;
+    gpointer data;
+} MediaScanWaiter_t;
+
+typedef struct {
+    gchar *path;
+    gint scan_types;
+    GSList *waiters;        /* MediaScanWaiter_t to notify when done */
+} MediaScanRequest_t;
+
+static struct {
+    Scanner1 *proxy;
+    GList *pending;         /* waiting for LMS, none below another one */
+    GList *running;         /* requests of the Scan in flight */
+    gboolean started;       /* LMS accepted the Scan in flight */
+    gboolean scanning;      /* LMS was seen scanning since it was issued */
+    guint generation;       /* of the Scan in flight */
+    guint64 update_id;      /* LMS UpdateID when it was issued */
+    guint watchdog;         /* source failing it if LMS does not start */
+    gint requests;          /* requests made */
+    gint merged;            /* requests merged into another one */
+    gint issued;            /* Scan calls made */
+    gint refused;           /* Scan calls LMS refused */
+} scans = { 0 };
+
+static gboolean path_is_within(const gchar *path, const gchar *root)
+{
+    const gsize len = strlen(root);
+
+    return strncmp(path, root, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/' ||
+            (len > 0 && root[len - 1] == '/'));
+}
+
+static void media_scan_request_free(MediaScanRequest_t *req)
+{
+    g_slist_free_full(req->waiters, g_free);
+    g_free(req->path);
+    g_free(req);
+}
+
+/* Tell everyone waiting on 'req' it is over, 'error' NULL on success */
+static void media_scan_notify(MediaScanRequest_t *req, const gchar *error)
+{
+    GSList *l;
+
+    for (l = req->waiters; l; l = l->next) {
+        MediaScanWaiter_t *waiter = l->data;
+
+        waiter->func(error, waiter->data);
+    }
+    media_scan_request_free(req);
+}
+
+/*
+ * Add 'req' to 'requests', where no request is below another one: a
+ * request for a path already covered joins the existing request, and a
+ * request for a parent directory absorbs the requests below it.
+ */
+static GList *media_scan_merge(GList *requests, MediaScanRequest_t *req)
+{
+    GList *l, *next;
+
+    for (l = requests; l; l = next) {
+        MediaScanRequest_t *other = l->data;
+
+        next = l->next;
+        if (path_is_within(req->path, other->path)) {
+            other->scan_types |= req->scan_types;
+            other->waiters = g_slist_concat(other->waiters, req->waiters);
+            req->waiters = NULL;
+            media_scan_request_free(req);
+            g_atomic_int_inc(&scans.merged);
+            return requests;
+        }
+        if (path_is_within(other->path, req->path)) {
+            req->scan_types |= other->scan_types;
+            req->waiters = g_slist_concat(req->waiters, other->waiters);
+            other->waiters = NULL;
+            media_scan_request_free(other);
+            requests = g_list_delete_link(requests, l);
+            g_atomic_int_inc(&scans.merged);
+        }
+    }
+    return g_list_prepend(requests, req);
+}
+
+/* The Scan in flight is over, 'error' NULL if it was done */
+static void media_scan_finish(const gchar *error)
+{
+    GList *running = scans.running;
+    GList *l;
+
+    if (scans.watchdog) {
+        g_source_remove(scans.watchdog);
+        scans.watchdog = 0;
+    }
+
+    scans.running = NULL;
+    for (l = running; l; l = l->next)
+        media_scan_notify(l->data, error);
+    g_list_free(running);
+}
+
+static void media_scan_issue(void);
+
+/*
+ * LMS accepted the Scan in flight but was not seen scanning since. Done
+ * if its UpdateID changed, LMS having been quicker than its IsScanning
+ * updates, failed otherwise.
+ */
+static gboolean media_scan_watchdog(gpointer unused)
+{
+    scans.watchdog = 0;
+    if (scanner1_get_update_id(scans.proxy) != scans.update_id) {
+        media_scan_finish(NULL);
+    } else {
+        LOGE("LMS did not start the scan\n");
+        media_scan_finish("LightMediaScanner did not start scanning");
+    }
+    media_scan_issue();
+    return G_SOURCE_REMOVE;
+}
+
+static void media_scan_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+    GError *error = NULL;
+    GList *running, *l;
+
+    if (scanner1_call_scan_finish(scans.proxy, res, &error)) {
+        /* Given up on already, see media_scan_owner_changed() */
+        if (GPOINTER_TO_UINT(data) != scans.generation || !scans.running)
+            return;
+
+        /* Running until LMS reports it is idle again */
+        scans.started = TRUE;
+        if (scanner1_get_is_scanning(scans.proxy))
+            scans.scanning = TRUE;
+        else
+            scans.watchdog = g_timeout_add_seconds(MEDIA_SCAN_START_TIMEOUT,
+                                                   media_scan_watchdog, NULL);
+        return;
+    }
+
+    if (GPOINTER_TO_UINT(data) != scans.generation || !scans.running) {
+        g_error_free(error);
+        return;
+    }
+
+    LOGE("LMS refused the scan: %s\n", error->message);
+    g_atomic_int_inc(&scans.refused);
+
+    running = scans.running;
+    scans.running = NULL;
+    for (l = running; l; l = l->next) {
+        /* LMS started scanning on its own: retry once it is done */
+        if (scanner1_get_is_scanning(scans.proxy))
+            scans.pending = media_scan_merge(scans.pending, l->data);
+        else
+            media_scan_notify(l->data, error->message);
+    }
+    g_list_free(running);
+    g_error_free(error);
+}
+
+/* Ask LMS to scan every pending path, unless it is busy */
+static void media_scan_issue(void)
+{
+    GVariantBuilder spec;
+    GList *l;
+    guint i;
+
+    if (!scans.proxy || scans.running || !scans.pending ||
+        scanner1_get_is_scanning(scans.proxy))
+        return;
+
+    scans.running = scans.pending;
+    scans.pending = NULL;
+    scans.started = FALSE;
+    scans.scanning = FALSE;
+    scans.generation++;
+    scans.update_id = scanner1_get_update_id(scans.proxy);
+
+    /* { "audio": <["/media/sda1"]>, "picture": <["/media/sda1"]> } */
+    g_variant_builder_init(&spec, G_VARIANT_TYPE_VARDICT);
+    for (i = 0; i < G_N_ELEMENTS(scan_categories); i++) {
+        GPtrArray *paths = g_ptr_array_new();
+
+        for (l = scans.running; l; l = l->next) {
+            MediaScanRequest_t *req = l->data;
+
+            if (req->scan_types & scan_categories[i].scan_type)
+                g_ptr_array_add(paths, req->path);
+        }
+        if (paths->len)
+            g_variant_builder_add(&spec, "{sv}", scan_categories[i].category,
+                                  g_variant_new_strv((const gchar * const *) paths->pdata,
+                                                     paths->len));
+        g_ptr_array_free(paths, TRUE);
+    }
+
+    LOGD("scanning %u paths\n", g_list_length(scans.running));
+    g_atomic_int_inc(&scans.issued);
+    scanner1_call_scan(scans.proxy, g_variant_builder_end(&spec), NULL,
+                       media_scan_done, GUINT_TO_POINTER(scans.generation));
+}
+
+static gboolean media_scan_submit(gpointer data)
+{
+    MediaScanRequest_t *req = data;
+
+    if (!scans.proxy) {
+        media_scan_notify(req, "LightMediaScanner is not available");
+        return G_SOURCE_REMOVE;
+    }
+
+    scans.pending = media_scan_merge(scans.pending, req);
+    media_scan_issue();
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Have LMS scan 'path' for the media of 'scan_types'. Requests for the
+ * same or nested paths made before LMS starts on them share one scan.
+ * 'func', if not NULL, is called on the manager event loop once the scan
+ * is over, with an error message if it could not be done. May be called
+ * from any thread.
+ */
+void media_scan_request(const gchar *path, gint scan_types,
+                        MediaScanFunc func, gpointer data)
+{
+    MediaScanRequest_t *req;
+
+    scan_types &= LMS_ALL_SCAN;
+    if (!scan_types) {
+        if (func)
+            func(NULL, data);
+        return;
+    }
+
+    g_atomic_int_inc(&scans.requests);
+    req = g_malloc0(sizeof(*req));
+    req->path = g_strdup(path);
+    req->scan_types = scan_types;
+    if (func) {
+        MediaScanWaiter_t *waiter = g_malloc0(sizeof(*waiter));
+
+        waiter->func = func;
+        waiter->data = data;
+        req->waiters = g_slist_prepend(NULL, waiter);
+    }
+
+    g_main_context_invoke(NULL, media_scan_submit, req);
+}
+
+/* The device at 'path' is gone, drop the scans waiting for it */
+void media_scan_cancel(const gchar *path)
+{
+    GList *l, *next;
+
+    for (l = scans.pending; l; l = next) {
+        MediaScanRequest_t *req = l->data;
+
+        next = l->next;
+        if (path_is_within(req->path, path)) {
+            media_scan_notify(req, "device removed");
+            scans.pending = g_list_delete_link(scans.pending, l);
+        }
+    }
+}
+
+/* LMS reports it is scanning */
+void media_scan_lms_scanning(void)
+{
+    if (!scans.running)
+        return;
+
+    scans.scanning = TRUE;
+    if (scans.watchdog) {
+        g_source_remove(scans.watchdog);
+        scans.watchdog = 0;
+    }
+}
+
+/*
+ * LMS may be idle: once it scanned since the Scan in flight was issued
+ * and is not scanning anymore, that Scan is over, start the next one.
+ */
+void media_scan_lms_idle(void)
+{
+    if (scans.proxy && scanner1_get_is_scanning(scans.proxy))
+        return;
+    if (scans.running && !(scans.started && scans.scanning))
+        return;
+
+    media_scan_finish(NULL);
+    media_scan_issue();
+}
+
+/*
+ * LMS left the bus or was restarted: the Scan in flight will never be
+ * reported over. Pending requests go to the new LMS, or fail with it
+ * gone.
+ */
+static void media_scan_owner_changed(GObject *object, GParamSpec *pspec,
+                                     gpointer unused)
+{
+    gchar *owner = g_dbus_proxy_get_name_owner(G_DBUS_PROXY(scans.proxy));
+
+    if (scans.running) {
+        LOGE("LMS %s during a scan\n", owner ? "restarted" : "exited");
+        media_scan_finish("LightMediaScanner exited");
+    }
+    g_free(owner);
+
+    media_scan_issue();
+}
+
+/* Whether 'path' is at or below one of the directories LMS indexes */
+static gboolean media_scan_path_in_lms_dirs(const gchar *path)
+{
+    GVariant *categories, *category;
+    GVariantIter iter;
+    const gchar *name;
+    gboolean found = FALSE;
+    guint i;
+
+    if (!scans.proxy)
+        return FALSE;
+    categories = scanner1_dup_categories(scans.proxy);
+    if (!categories)
+        return FALSE;
+
+    /* { "audio": <{ "dirs": <["/media", ...]>, ... }>, ... } */
+    g_variant_iter_init(&iter, categories);
+    while (!found && g_variant_iter_next(&iter, "{&sv}", &name, &category)) {
+        const gchar **dirs = NULL;
+
+        if (g_variant_lookup(category, "dirs", "^a&s", &dirs)) {
+            for (i = 0; dirs[i] && !found; i++)
+                found = path_is_within(path, dirs[i]);
+            g_free(dirs);
+        }
+        g_variant_unref(category);
+    }
+    g_variant_unref(categories);
+
+    return found;
+}
+
+/*
+ * Whether a rescan of 'path' may be asked for: it must be at or below a
+ * mounted device or a directory LMS indexes. May be called from any
+ * thread.
+ */
+gboolean media_scan_path_allowed(const gchar *path)
+{
+    return media_mount_contains(path) || media_scan_path_in_lms_dirs(path);
+}
+
+void media_scan_stats(MediaScanStats_t *stats)
+{
+    stats->requests = g_atomic_int_get(&scans.requests);
+    stats->merged = g_atomic_int_get(&scans.merged);
+    stats->issued = g_atomic_int_get(&scans.issued);
+    stats->refused = g_atomic_int_get(&scans.refused);
+}
+
+void media_scan_init(Scanner1 *proxy)
+{
+    scans.proxy = proxy;
+    if (proxy)
+        g_signal_connect(proxy, "notify::g-name-owner",
+                         G_CALLBACK(media_scan_owner_changed), NULL);
+}
@@ -0,0 +1,603 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Full-text search index
+ *
+ * Media metadata are indexed with FTS5 in a SQLite file of our own, next
+ * to the LMS database we only read. The index folds case and diacritics
+ * and keeps prefixes of 2 and 3 characters, so that searching as the user
+ * types stays cheap.
+ *
+ * A thread keeps the index in sync with the LMS catalogue whenever
+ * LMS reports a new UpdateID. It only reads the media LMS wrote after the
+ * UpdateID the index was last synced at, kept in media_state, and lists
+ * the files of the catalogue only when some of the indexed ones are gone
+ * from it. A signature of every indexed file saves writing the media LMS
+ * wrote again unchanged.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "media-manager.h"
+
+/* Bump when the schema changes, the index is then built again */
+#define MEDIA_SEARCH_SCHEMA 1
+
+#define MEDIA_SEARCH_SCHEMA_SQL \
+    "CREATE VIRTUAL TABLE IF NOT EXISTS media_fts USING fts5(" \
+    " title, artist, album, genre, name," \
+    " type UNINDEXED, uri UNINDEXED, file UNINDEXED, duration UNINDEXED," \
+    " tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3');" \
+    "CREATE TABLE IF NOT EXISTS media_docs (" \
+    " id INTEGER PRIMARY KEY, file TEXT NOT NULL UNIQUE, sig INTEGER NOT NULL);" \
+    "CREATE TABLE IF NOT EXISTS media_state (" \
+    " key TEXT PRIMARY KEY, value INTEGER);"
+
+#define MEDIA_SEARCH_DROP_SQL \
+    "DROP TABLE IF EXISTS media_fts;" \
+    "DROP TABLE IF EXISTS media_docs;" \
+    "DROP TABLE IF EXISTS media_state;"
+
+/* Matches in the title weigh most, then artist, album, file name, genre */
+#define MEDIA_SEARCH_SQL_QUERY \
+    "SELECT type, uri, file, title, artist, album, genre, duration " \
+    "FROM media_fts WHERE media_fts MATCH :match " \
+    "AND ((:types >> type) & 1) " \
+    "ORDER BY bm25(media_fts, 10.0, 5.0, 3.0, 1.0, 2.0) " \
+    "LIMIT :limit"
+
+/* Extra rows read in case some of the files are gone */
+#define MEDIA_SEARCH_SLACK 16
+
+enum {
+    SQL_DOC_INSERT,
+    SQL_DOC_UPDATE,
+    SQL_DOC_DELETE,
+    SQL_FTS_INSERT,
+    SQL_FTS_DELETE,
+    SQL_STATE_SET,
+    SQL_COUNT
+};
+
+static const gchar *sync_sql[SQL_COUNT] = {
+    [SQL_DOC_INSERT] = "INSERT INTO media_docs (file, sig) VALUES (?, ?)",
+    [SQL_DOC_UPDATE] = "UPDATE media_docs SET sig = ? WHERE id = ?",
+    [SQL_DOC_DELETE] = "DELETE FROM media_docs WHERE id = ?",
+    [SQL_FTS_INSERT] = "INSERT INTO media_fts (rowid, title, artist, album, genre,"
+                       " name, type, uri, file, duration)"
+                       " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    [SQL_FTS_DELETE] = "DELETE FROM media_fts WHERE rowid = ?",
+    [SQL_STATE_SET]  = "INSERT OR REPLACE INTO media_state (key, value) VALUES (?, ?)",
+};
+
+/* A file in the index */
+typedef struct {
+    gint64 id;
+    guint sig;
+    guint seen;         /* last sync the file was in the catalogue */
+} MediaSearchDoc_t;
+
+typedef struct {
+    guint sync;
+    gint added;
+    gint changed;
+    gint removed;
+    gboolean failed;    /* a write failed, the sync is given up */
+} MediaSearchSync_t;
+
+static struct {
+    gchar *path;
+    sqlite3 *writer;        /* owned by the sync thread */
+    sqlite3_stmt *stmts[SQL_COUNT];
+    GHashTable *docs;       /* file -> MediaSearchDoc_t, sync thread only */
+    gint64 update_id;       /* UpdateID the index is synced at, or -1 */
+    guint syncs;
+    GMutex m;               /* protects reader */
+    sqlite3 *reader;
+    sqlite3_stmt *query;
+    GAsyncQueue *updates;   /* wakes the sync thread up */
+    GThread *thread;
+} search = { 0 };
+
+static gboolean media_search_load(void);
+
+static sqlite3 *media_search_open(int flags)
+{
+    sqlite3 *db = NULL;
+
+    if (sqlite3_open_v2(search.path, &db, flags | SQLITE_OPEN_NOMUTEX,
+                        NULL) != SQLITE_OK) {
+        LOGE("Cannot open search index %s: %s\n", search.path,
+             db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db, MEDIA_DB_BUSY_TIMEOUT);
+    return db;
+}
+
+static guint media_search_signature(gint id, const MediaItem_t *item)
+{
+    const gchar *fields[] = {
+        item->path, item->metadata.title, item->metadata.artist,
+        item->metadata.album, item->metadata.genre,
+    };
+    guint sig = id * 31 + item->metadata.duration;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(fields); i++)
+        sig = sig * 33 + (fields[i] ? g_str_hash(fields[i]) : 0);
+    return sig;
+}
+
+static void media_search_bind_text(sqlite3_stmt *res, int idx, const gchar *text)
+{
+    if (text)
+        sqlite3_bind_text(res, idx, text, -1, SQLITE_STATIC);
+    else
+        sqlite3_bind_null(res, idx);
+}
+
+static gboolean media_search_step(sqlite3_stmt *res)
+{
+    const int ret = sqlite3_step(res);
+
+    sqlite3_reset(res);
+    sqlite3_clear_bindings(res);
+    if (ret != SQLITE_DONE) {
+        LOGE("Cannot update search index: %s\n", sqlite3_errmsg(search.writer));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean media_search_index(gint64 id, gint scan_type_id,
+                                   const gchar *file, const MediaItem_t *item)
+{
+    sqlite3_stmt *res = search.stmts[SQL_FTS_INSERT];
+    gchar *name = g_path_get_basename(file);
+    gboolean ret;
+
+    sqlite3_bind_int64(res, 1, id);
+    media_search_bind_text(res, 2, item->metadata.title);
+    media_search_bind_text(res, 3, item->metadata.artist);
+    media_search_bind_text(res, 4, item->metadata.album);
+    media_search_bind_text(res, 5, item->metadata.genre);
+    media_search_bind_text(res, 6, name);
+    sqlite3_bind_int(res, 7, scan_type_id);
+    media_search_bind_text(res, 8, item->path);
+    media_search_bind_text(res, 9, file);
+    sqlite3_bind_int(res, 10, item->metadata.duration);
+    ret = media_search_step(res);
+    g_free(name);
+    return ret;
+}
+
+static gboolean media_search_unindex(gint64 id)
+{
+    sqlite3_bind_int64(search.stmts[SQL_FTS_DELETE], 1, id);
+    return media_search_step(search.stmts[SQL_FTS_DELETE]);
+}
+
+/* Add or refresh one catalogue entry */
+static void media_search_sync_entry(gint scan_type_id, const gchar *file,
+                                    const MediaItem_t *item, gpointer data)
+{
+    MediaSearchSync_t *sync = data;
+    const guint sig = media_search_signature(scan_type_id, item);
+    MediaSearchDoc_t *doc = g_hash_table_lookup(search.docs, file);
+    sqlite3_stmt *res;
+
+    if (sync->failed)
+        return;
+
+    if (doc && doc->sig == sig) {
+        doc->seen = sync->sync;
+        return;
+    }
+
+    if (doc) {
+        res = search.stmts[SQL_DOC_UPDATE];
+        sqlite3_bind_int64(res, 1, sig);
+        sqlite3_bind_int64(res, 2, doc->id);
+        if (!media_search_step(res) || !media_search_unindex(doc->id)) {
+            sync->failed = TRUE;
+            return;
+        }
+        sync->changed++;
+    } else {
+        res = search.stmts[SQL_DOC_INSERT];
+        media_search_bind_text(res, 1, file);
+        sqlite3_bind_int64(res, 2, sig);
+        if (!media_search_step(res)) {
+            sync->failed = TRUE;
+            return;
+        }
+        doc = g_malloc0(sizeof(*doc));
+        doc->id = sqlite3_last_insert_rowid(search.writer);
+        g_hash_table_insert(search.docs, g_strdup(file), doc);
+        sync->added++;
+    }
+    doc->sig = sig;
+    doc->seen = sync->sync;
+    if (!media_search_index(doc->id, scan_type_id, file, item))
+        sync->failed = TRUE;
+}
+
+/* Mark an indexed file as still in the catalogue */
+static void media_search_sweep_entry(const gchar *file, gpointer data)
+{
+    MediaSearchSync_t *sync = data;
+    MediaSearchDoc_t *doc = g_hash_table_lookup(search.docs, file);
+
+    if (doc)
+        doc->seen = sync->sync;
+}
+
+/* Drop the indexed files the catalogue did not list during the sync */
+static void media_search_sweep(MediaSearchSync_t *sync)
+{
+    sqlite3_stmt *res = search.stmts[SQL_DOC_DELETE];
+    MediaSearchDoc_t *doc;
+    GHashTableIter iter;
+
+    g_hash_table_iter_init(&iter, search.docs);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &doc)) {
+        if (doc->seen == sync->sync)
+            continue;
+        sqlite3_bind_int64(res, 1, doc->id);
+        if (!media_search_unindex(doc->id) || !media_search_step(res)) {
+            sync->failed = TRUE;
+            return;
+        }
+        g_hash_table_iter_remove(&iter);
+        sync->removed++;
+    }
+}
+
+/* Give a sync up, back to what the index holds */
+static void media_search_abort(void)
+{
+    sqlite3_exec(search.writer, "ROLLBACK", NULL, NULL, NULL);
+    g_hash_table_remove_all(search.docs);
+    media_search_load();
+}
+
+/*
+ * Bring the index in line with the catalogue: index the media LMS wrote
+ * since the last sync and, when the catalogue holds fewer media than the
+ * index, list its files to drop the ones gone. Any failure leaves the
+ * index as it was.
+ */
+static void media_search_sync(void)
+{
+    MediaSearchSync_t sync = { ++search.syncs, 0, 0, 0, FALSE };
+    gchar *error = NULL;
+    gint64 update_id;
+    gint count;
+    sqlite3_stmt *res;
+
+    sqlite3_exec(search.writer, "BEGIN", NULL, NULL, NULL);
+    if (media_catalogue_foreach(media_search_sync_entry, &sync,
+                                search.update_id, &update_id, &count,
+                                &error) < 0) {
+        /* Files not read are not gone: keep the index as it was */
+        LOGE("Cannot index the media catalogue: %s\n", error);
+        g_free(error);
+        media_search_abort();
+        return;
+    }
+
+    /* The index holds every media of the catalogue, extra ones are gone */
+    if (!sync.failed && count != (gint) g_hash_table_size(search.docs)) {
+        if (media_catalogue_files(media_search_sweep_entry, &sync, &error) < 0) {
+            LOGE("Cannot list the media catalogue: %s\n", error);
+            g_free(error);
+            media_search_abort();
+            return;
+        }
+        media_search_sweep(&sync);
+    }
+
+    if (!sync.failed) {
+        res = search.stmts[SQL_STATE_SET];
+        sqlite3_bind_text(res, 1, "update_id", -1, SQLITE_STATIC);
+        sqlite3_bind_int64(res, 2, update_id);
+        sync.failed = !media_search_step(res);
+    }
+    if (sync.failed) {
+        media_search_abort();
+        return;
+    }
+    if (sqlite3_exec(search.writer, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        LOGE("Cannot commit search index: %s\n", sqlite3_errmsg(search.writer));
+        media_search_abort();
+        return;
+    }
+    search.update_id = update_id;
+
+    LOGD("search index: %d added, %d changed, %d removed\n",
+         sync.added, sync.changed, sync.removed);
+}
+
+static void *media_search_thread(void *unused)
+{
+    for (;;) {
+        /* Updates queued meanwhile are covered by a single sync */
+        g_async_queue_pop(search.updates);
+        while (g_async_queue_try_pop(search.updates))
+            ;
+        media_search_sync();
+    }
+
+    return NULL;
+}
+
+/* LMS has a new UpdateID: sync the index in the background */
+void media_search_update(void)
+{
+    if (search.thread)
+        g_async_queue_push(search.updates, GINT_TO_POINTER(1));
+}
+
+/*
+ * FTS5 query matching every word of 'text' as a prefix, e.g. "queen bo"
+ * gives "queen"* "bo"*. Words are runs of letters and digits, so nothing
+ * in the user text is taken as FTS5 syntax. NULL when there is no word.
+ */
+static gchar *media_search_match(const gchar *text)
+{
+    GString *match = g_string_new(NULL);
+    gboolean in_word = FALSE;
+    const gchar *p;
+
+    for (p = text; *p; p = g_utf8_next_char(p)) {
+        const gboolean alnum = g_unichar_isalnum(g_utf8_get_char(p));
+
+        if (alnum && !in_word)
+            g_string_append(match, match->len ? " \"" : "\"");
+        else if (!alnum && in_word)
+            g_string_append(match, "\"*");
+        if (alnum)
+            g_string_append_len(match, p, g_utf8_next_char(p) - p);
+        in_word = alnum;
+    }
+    if (in_word)
+        g_string_append(match, "\"*");
+
+    if (match->len == 0) {
+        g_string_free(match, TRUE);
+        return NULL;
+    }
+    return g_string_free(match, FALSE);
+}
+
+static const gchar *arena_insert_column(GStringChunk *arena, sqlite3_stmt *res,
+                                        int col)
+{
+    const unsigned char *text = sqlite3_column_text(res, col);
+
+    return text ? g_string_chunk_insert(arena, (const gchar *) text) : NULL;
+}
+
+/*
+ * Best matches of 'text' among the media of 'scan_types', at most
+ * 'limit' of them, best first.
+ */
+MediaSearchResult_t *media_search(const gchar *text, gint scan_types,
+                                  gint limit, gchar **error)
+{
+    MediaSearchResult_t *result;
+    gchar *failure = NULL;
+    gchar *match;
+    int ret;
+
+    if (!search.reader) {
+        *error = g_strdup("Search index unavailable");
+        return NULL;
+    }
+    if (!g_utf8_validate(text, -1, NULL) || !(match = media_search_match(text))) {
+        *error = g_strdup("Invalid search text");
+        return NULL;
+    }
+
+    result = g_malloc0(sizeof(*result));
+    result->hits = g_array_new(FALSE, FALSE, sizeof(MediaSearchHit_t));
+    result->arena = g_string_chunk_new(4096);
+
+    g_mutex_lock(&search.m);
+    sqlite3_bind_text(search.query, 1, match, -1, SQLITE_STATIC);
+    sqlite3_bind_int(search.query, 2, scan_types);
+    sqlite3_bind_int(search.query, 3, limit + MEDIA_SEARCH_SLACK);
+
+    while ((ret = sqlite3_step(search.query)) == SQLITE_ROW &&
+           result->hits->len < (guint) limit) {
+        MediaSearchHit_t hit = { 0 };
+        const gchar *file = (const gchar *) sqlite3_column_text(search.query, 2);
+
+        if (!file || !media_validator_is_valid(file))
+            continue;
+
+        hit.scan_type_id = sqlite3_column_int(search.query, 0);
+        if (hit.scan_type_id < LMS_MIN_ID || hit.scan_type_id >= LMS_SCAN_COUNT)
+            continue;
+        hit.item.path = arena_insert_column(result->arena, search.query, 1);
+        hit.item.metadata.title = arena_insert_column(result->arena, search.query, 3);
+        hit.item.metadata.artist = arena_insert_column(result->arena, search.query, 4);
+        hit.item.metadata.album = arena_insert_column(result->arena, search.query, 5);
+        hit.item.metadata.genre = arena_insert_column(result->arena, search.query, 6);
+        hit.item.metadata.duration = sqlite3_column_int(search.query, 7);
+        g_array_append_val(result->hits, hit);
+    }
+    if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+        failure = g_strdup_printf("Search failed: %s", sqlite3_errmsg(search.reader));
+
+    sqlite3_reset(search.query);
+    sqlite3_clear_bindings(search.query);
+    g_mutex_unlock(&search.m);
+    g_free(match);
+
+    if (failure) {
+        media_search_result_free(result);
+        *error = failure;
+        return NULL;
+    }
+    return result;
+}
+
+void media_search_result_free(MediaSearchResult_t *result)
+{
+    if (result) {
+        g_array_free(result->hits, TRUE);
+        g_string_chunk_free(result->arena);
+        g_free(result);
+    }
+}
+
+/* Create the schema, from scratch if it is outdated */
+static gboolean media_search_schema(sqlite3 *db)
+{
+    sqlite3_stmt *res;
+    gchar *sql;
+    int version = 0;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &res, NULL) == SQLITE_OK &&
+        sqlite3_step(res) == SQLITE_ROW)
+        version = sqlite3_column_int(res, 0);
+    sqlite3_finalize(res);
+
+    sql = g_strdup_printf("PRAGMA journal_mode=WAL;"
+                          "BEGIN;"
+                          "%s%s"
+                          "PRAGMA user_version=%d;"
+                          "COMMIT;",
+                          version != MEDIA_SEARCH_SCHEMA ? MEDIA_SEARCH_DROP_SQL : "",
+                          MEDIA_SEARCH_SCHEMA_SQL, MEDIA_SEARCH_SCHEMA);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        LOGE("Cannot create search index: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        g_free(sql);
+        return FALSE;
+    }
+    g_free(sql);
+    return TRUE;
+}
+
+/* Files indexed so far, with their signature, and the UpdateID of the index */
+static gboolean media_search_load(void)
+{
+    sqlite3_stmt *res;
+
+    search.update_id = -1;
+    if (sqlite3_prepare_v2(search.writer,
+                           "SELECT value FROM media_state WHERE key = 'update_id'",
+                           -1, &res, NULL) != SQLITE_OK)
+        return FALSE;
+    if (sqlite3_step(res) == SQLITE_ROW)
+        search.update_id = sqlite3_column_int64(res, 0);
+    sqlite3_finalize(res);
+
+    if (sqlite3_prepare_v2(search.writer, "SELECT id, file, sig FROM media_docs",
+                           -1, &res, NULL) != SQLITE_OK)
+        return FALSE;
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        MediaSearchDoc_t *doc = g_malloc0(sizeof(*doc));
+
+        doc->id = sqlite3_column_int64(res, 0);
+        doc->sig = (guint) sqlite3_column_int64(res, 2);
+        g_hash_table_insert(search.docs,
+                            g_strdup((const gchar *) sqlite3_column_text(res, 1)),
+                            doc);
+    }
+    sqlite3_finalize(res);
+    return TRUE;
+}
+
+/* Index in the SQLite file at 'path', created if needed */
+void media_search_configure(const gchar *path)
+{
+    g_free(search.path);
+    search.path = g_strdup(path);
+}
+
+/*
+ * Open the index and start the sync thread, which indexes the catalogue
+ * right away. Searches fail if the index cannot be opened.
+ */
+int media_search_init(void)
+{
+    gchar *dir;
+    gint i;
+
+    if (!search.path)
+        search.path = g_build_filename(g_get_user_cache_dir(),
+                                       "mediascanner", "search.db", NULL);
+    dir = g_path_get_dirname(search.path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    g_mutex_init(&search.m);
+    search.docs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    search.updates = g_async_queue_new();
+
+    search.writer = media_search_open(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    if (!search.writer || !media_search_schema(search.writer) ||
+        !media_search_load())
+        goto fail;
+    for (i = 0; i < SQL_COUNT; i++) {
+        if (sqlite3_prepare_v3(search.writer, sync_sql[i], -1,
+                               SQLITE_PREPARE_PERSISTENT, &search.stmts[i],
+                               NULL) != SQLITE_OK) {
+            LOGE("Cannot prepare search index update: %s\n",
+                 sqlite3_errmsg(search.writer));
+            goto fail;
+        }
+    }
+
+    search.reader = media_search_open(SQLITE_OPEN_READONLY);
+    if (!search.reader ||
+        sqlite3_prepare_v3(search.reader, MEDIA_SEARCH_SQL_QUERY, -1,
+                           SQLITE_PREPARE_PERSISTENT, &search.query,
+                           NULL) != SQLITE_OK) {
+        LOGE("Cannot prepare search query: %s\n",
+             search.reader ? sqlite3_errmsg(search.reader) : "no index");
+        goto fail;
+    }
+
+    search.thread = g_thread_try_new("media-search", media_search_thread,
+                                     NULL, NULL);
+    if (!search.thread) {
+        LOGE("Cannot start the search index thread\n");
+        goto fail;
+    }
+    media_search_update();
+    return 0;
+
+fail:
+    for (i = 0; i < SQL_COUNT; i++)
+        sqlite3_finalize(search.stmts[i]);
+    sqlite3_finalize(search.query);
+    sqlite3_close(search.reader);
+    sqlite3_close(search.writer);
+    search.query = NULL;
+    search.reader = search.writer = NULL;
+    return -1;
+}
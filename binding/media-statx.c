@@ -0,0 +1,257 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Batched file existence checks
+ *
+ * A batch of paths is checked either with one io_uring submission of
+ * statx requests, on a pool of threads each doing blocking stat() calls,
+ * or serially. The first two overlap the metadata lookups, which is what
+ * matters on high latency storage such as USB mass storage.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "media-manager.h"
+
+/* Threads used by the MEDIA_STAT_THREADS backend */
+#define MEDIA_STAT_POOL_SIZE 8
+
+typedef struct {
+    gchar **paths;
+    gboolean *exists;
+    guint pending;
+    GMutex m;
+    GCond done;
+} StatJob_t;
+
+typedef struct {
+    StatJob_t *job;
+    guint idx;
+} StatTask_t;
+
+struct _MediaStatBatch {
+    MediaStatBackend_t backend;
+    GThreadPool *pool;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    struct statx stx[MEDIA_VALIDATOR_BATCH];
+#endif
+};
+
+static const gchar *backend_names[] = {
+    [MEDIA_STAT_SERIAL]  = "serial",
+    [MEDIA_STAT_THREADS] = "threads",
+    [MEDIA_STAT_URING]   = "io_uring",
+};
+
+static void stat_pool_func(gpointer data, gpointer unused)
+{
+    StatTask_t *task = data;
+    StatJob_t *job = task->job;
+    struct stat buf;
+    gboolean exists = stat(job->paths[task->idx], &buf) == 0;
+
+    g_mutex_lock(&job->m);
+    job->exists[task->idx] = exists;
+    if (--job->pending == 0)
+        g_cond_signal(&job->done);
+    g_mutex_unlock(&job->m);
+}
+
+static void stat_batch_threads(MediaStatBatch_t *batch, gchar **paths,
+                               gboolean *exists, guint n)
+{
+    StatTask_t tasks[MEDIA_VALIDATOR_BATCH];
+    StatJob_t job = { paths, exists, n };
+    guint i;
+
+    g_mutex_init(&job.m);
+    g_cond_init(&job.done);
+
+    for (i = 0; i < n; i++) {
+        tasks[i].job = &job;
+        tasks[i].idx = i;
+        g_thread_pool_push(batch->pool, &tasks[i], NULL);
+    }
+
+    g_mutex_lock(&job.m);
+    while (job.pending > 0)
+        g_cond_wait(&job.done, &job.m);
+    g_mutex_unlock(&job.m);
+
+    g_cond_clear(&job.done);
+    g_mutex_clear(&job.m);
+}
+
+static void stat_batch_serial(gchar **paths, gboolean *exists, guint n)
+{
+    struct stat buf;
+    guint i;
+
+    for (i = 0; i < n; i++)
+        exists[i] = stat(paths[i], &buf) == 0;
+}
+
+#ifdef HAVE_LIBURING
+/* Leave io_uring for the thread pool, or serial checks without threads */
+static void stat_batch_fallback(MediaStatBatch_t *batch)
+{
+    batch->pool = g_thread_pool_new(stat_pool_func, NULL,
+                                    MEDIA_STAT_POOL_SIZE, FALSE, NULL);
+    batch->backend = batch->pool ? MEDIA_STAT_THREADS : MEDIA_STAT_SERIAL;
+}
+
+static void stat_batch_uring(MediaStatBatch_t *batch, gchar **paths,
+                             gboolean *exists, guint n)
+{
+    gboolean reaped[MEDIA_VALIDATOR_BATCH] = { FALSE };
+    struct io_uring_cqe *cqe;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+
+        io_uring_prep_statx(sqe, AT_FDCWD, paths[i], 0, STATX_TYPE,
+                            &batch->stx[i]);
+        io_uring_sqe_set_data(sqe, (void *) (uintptr_t) i);
+    }
+
+    /*
+     * Requests left in a ring that failed to submit would point to stale
+     * buffers on the next batch: give up on io_uring altogether and let
+     * the thread pool take over.
+     */
+    if (io_uring_submit_and_wait(&batch->ring, n) < 0) {
+        io_uring_queue_exit(&batch->ring);
+        stat_batch_fallback(batch);
+        media_stat_batch_check(batch, paths, exists, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        guint idx;
+
+        if (io_uring_wait_cqe(&batch->ring, &cqe) < 0)
+            break;
+        idx = (uintptr_t) io_uring_cqe_get_data(cqe);
+        exists[idx] = cqe->res == 0;
+        reaped[idx] = TRUE;
+        io_uring_cqe_seen(&batch->ring, cqe);
+    }
+
+    if (i == n)
+        return;
+
+    /*
+     * Completions still due would be taken for the next batch's: start
+     * over with a fresh ring and check what was not reaped here serially.
+     */
+    io_uring_queue_exit(&batch->ring);
+    if (io_uring_queue_init(MEDIA_VALIDATOR_BATCH, &batch->ring, 0) < 0)
+        stat_batch_fallback(batch);
+
+    for (i = 0; i < n; i++) {
+        struct stat buf;
+
+        if (!reaped[i])
+            exists[i] = stat(paths[i], &buf) == 0;
+    }
+}
+#endif
+
+/*
+ * Create a batch checker for 'backend', falling back to the next cheaper
+ * backend when it is not available (io_uring missing at build time or
+ * refused by the kernel, thread creation failing).
+ */
+MediaStatBatch_t *media_stat_batch_new(MediaStatBackend_t backend)
+{
+    MediaStatBatch_t *batch = g_malloc0(sizeof(*batch));
+
+#ifdef HAVE_LIBURING
+    if (backend == MEDIA_STAT_URING &&
+        io_uring_queue_init(MEDIA_VALIDATOR_BATCH, &batch->ring, 0) == 0) {
+        batch->backend = MEDIA_STAT_URING;
+        return batch;
+    }
+#endif
+
+    if (backend >= MEDIA_STAT_THREADS) {
+        batch->pool = g_thread_pool_new(stat_pool_func, NULL,
+                                        MEDIA_STAT_POOL_SIZE, FALSE, NULL);
+        if (batch->pool) {
+            batch->backend = MEDIA_STAT_THREADS;
+            return batch;
+        }
+    }
+
+    batch->backend = MEDIA_STAT_SERIAL;
+    return batch;
+}
+
+MediaStatBackend_t media_stat_batch_backend(MediaStatBatch_t *batch)
+{
+    return batch->backend;
+}
+
+const gchar *media_stat_backend_name(MediaStatBackend_t backend)
+{
+    return backend_names[backend];
+}
+
+/* Set exists[i] for each of the n (<= MEDIA_VALIDATOR_BATCH) paths */
+void media_stat_batch_check(MediaStatBatch_t *batch, gchar **paths,
+                            gboolean *exists, guint n)
+{
+    switch (batch->backend) {
+#ifdef HAVE_LIBURING
+        case MEDIA_STAT_URING:
+            stat_batch_uring(batch, paths, exists, n);
+            break;
+#endif
+        case MEDIA_STAT_THREADS:
+            stat_batch_threads(batch, paths, exists, n);
+            break;
+        case MEDIA_STAT_SERIAL:
+        default:
+            stat_batch_serial(paths, exists, n);
+    }
+}
+
+void media_stat_batch_free(MediaStatBatch_t *batch)
+{
+    if (!batch)
+        return;
+
+#ifdef HAVE_LIBURING
+    if (batch->backend == MEDIA_STAT_URING)
+        io_uring_queue_exit(&batch->ring);
+#endif
+    if (batch->pool)
+        g_thread_pool_free(batch->pool, FALSE, TRUE);
+    g_free(batch);
+}
@@ -0,0 +1,238 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * File validity tracker
+ *
+ * The LMS database may still list files that are gone, e.g. until LMS
+ * notices a removed device. Rather than stat()ing every row of every
+ * query, the query path asks this tracker, which answers from a hash
+ * table and queues paths it has not seen yet for a background thread
+ * to check in batches (see media-statx.c). Unmounted devices are learnt
+ * from the /media monitor and invalidate all their paths at once.
+ *
+ * The table holds at most MEDIA_VALIDATOR_MAX_PATHS paths. Past that,
+ * verdicts are dropped, files found first, and checked again the next
+ * time they are asked for. Paths of unmounted devices are not kept at
+ * all, their mount root answers for them.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+typedef enum {
+    PATH_PENDING = 1,   /* queued for the validator thread */
+    PATH_PRESENT,
+    PATH_MISSING,
+} PathState_t;
+
+typedef struct {
+    GMutex m;
+    GHashTable *paths;      /* path -> PathState_t */
+    GHashTable *unmounted;  /* mount roots reported as removed */
+    GAsyncQueue *queue;     /* paths waiting to be checked */
+    GThread *thread;
+} MediaValidator_t;
+
+static MediaValidator_t validator = { 0 };
+
+static gboolean path_is_below(const gchar *path, const gchar *root)
+{
+    const gsize len = strlen(root);
+
+    return strncmp(path, root, len) == 0 && path[len] == '/';
+}
+
+static gboolean path_is_unmounted(const gchar *path)
+{
+    GHashTableIter iter;
+    gpointer root;
+
+    g_hash_table_iter_init(&iter, validator.unmounted);
+    while (g_hash_table_iter_next(&iter, &root, NULL)) {
+        if (path_is_below(path, root))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Drop verdicts, files found first, then files missing, until the table
+ * is back to 3/4 of its bound. Paths being checked are kept. Called with
+ * validator.m held.
+ */
+static void media_validator_evict(void)
+{
+    const guint target = MEDIA_VALIDATOR_MAX_PATHS / 4 * 3;
+    PathState_t victim;
+    GHashTableIter iter;
+    gpointer state;
+
+    for (victim = PATH_PRESENT; victim <= PATH_MISSING; victim++) {
+        g_hash_table_iter_init(&iter, validator.paths);
+        while (g_hash_table_size(validator.paths) > target &&
+               g_hash_table_iter_next(&iter, NULL, &state)) {
+            if (GPOINTER_TO_INT(state) == victim)
+                g_hash_table_iter_remove(&iter);
+        }
+    }
+}
+
+static void *media_validator_thread(void *unused)
+{
+    gchar *batch[MEDIA_VALIDATOR_BATCH];
+    gboolean exists[MEDIA_VALIDATOR_BATCH];
+    MediaStatBatch_t *checker = media_stat_batch_new(MEDIA_STAT_URING);
+    gboolean missing;
+    guint n, i;
+
+    LOGD("checking files with the %s backend\n",
+         media_stat_backend_name(media_stat_batch_backend(checker)));
+
+    for (;;) {
+        /* Block for the first path, then drain what is already queued */
+        batch[0] = g_async_queue_pop(validator.queue);
+        for (n = 1; n < MEDIA_VALIDATOR_BATCH; n++) {
+            batch[n] = g_async_queue_try_pop(validator.queue);
+            if (!batch[n])
+                break;
+        }
+
+        media_stat_batch_check(checker, batch, exists, n);
+
+        missing = FALSE;
+        g_mutex_lock(&validator.m);
+        for (i = 0; i < n; i++) {
+            /* The entry may have been invalidated while it was checked */
+            if (GPOINTER_TO_INT(g_hash_table_lookup(validator.paths, batch[i])) ==
+                PATH_PENDING) {
+                g_hash_table_insert(validator.paths, batch[i],
+                    GINT_TO_POINTER(exists[i] ? PATH_PRESENT : PATH_MISSING));
+                missing |= !exists[i];
+            } else
+                g_free(batch[i]);
+        }
+        g_mutex_unlock(&validator.m);
+
+        /* Cached replies may still list the files found missing */
+        if (missing)
+            media_cache_invalidate();
+    }
+
+    return NULL;
+}
+
+/*
+ * Return FALSE if 'path' is known not to exist. Paths seen for the first
+ * time are reported valid and checked in the background, so that the
+ * caller never waits on the storage device.
+ */
+gboolean media_validator_is_valid(const gchar *path)
+{
+    gboolean valid = TRUE;
+
+    g_mutex_lock(&validator.m);
+    switch (GPOINTER_TO_INT(g_hash_table_lookup(validator.paths, path))) {
+        case PATH_MISSING:
+            valid = FALSE;
+            break;
+        case PATH_PENDING:
+        case PATH_PRESENT:
+            break;
+        default:
+            if (path_is_unmounted(path)) {
+                valid = FALSE;
+            } else {
+                if (g_hash_table_size(validator.paths) >= MEDIA_VALIDATOR_MAX_PATHS)
+                    media_validator_evict();
+                g_hash_table_insert(validator.paths, g_strdup(path),
+                                    GINT_TO_POINTER(PATH_PENDING));
+                g_async_queue_push(validator.queue, g_strdup(path));
+            }
+    }
+    g_mutex_unlock(&validator.m);
+
+    return valid;
+}
+
+/*
+ * Every path below 'root' is gone along with its device, which 'root'
+ * now answers for: their entries are dropped
+ */
+void media_validator_device_removed(const gchar *root)
+{
+    GHashTableIter iter;
+    gpointer path;
+
+    g_mutex_lock(&validator.m);
+    g_hash_table_add(validator.unmounted, g_strdup(root));
+    g_hash_table_iter_init(&iter, validator.paths);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        if (path_is_below(path, root))
+            g_hash_table_iter_remove(&iter);
+    }
+    g_mutex_unlock(&validator.m);
+
+    media_cache_invalidate();
+}
+
+/* Forget what was known below 'root' so that it gets checked again */
+void media_validator_device_added(const gchar *root)
+{
+    GHashTableIter iter;
+    gpointer path;
+
+    g_mutex_lock(&validator.m);
+    g_hash_table_remove(validator.unmounted, root);
+    g_hash_table_iter_init(&iter, validator.paths);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        if (path_is_below(path, root))
+            g_hash_table_iter_remove(&iter);
+    }
+    g_mutex_unlock(&validator.m);
+}
+
+/*
+ * Drop every verdict, e.g. once LMS has rescanned. Paths are checked
+ * again the next time a query returns them.
+ */
+void media_validator_reset(void)
+{
+    g_mutex_lock(&validator.m);
+    g_hash_table_remove_all(validator.paths);
+    g_mutex_unlock(&validator.m);
+}
+
+int media_validator_init(void)
+{
+    g_mutex_init(&validator.m);
+    validator.paths = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, NULL);
+    validator.unmounted = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    validator.queue = g_async_queue_new_full(g_free);
+
+    validator.thread = g_thread_try_new("media-validator",
+                                        media_validator_thread, NULL, NULL);
+    if (!validator.thread) {
+        LOGE("Cannot start the file validator thread\n");
+        return -1;
+    }
+    return 0;
+}
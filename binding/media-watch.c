@@ -0,0 +1,497 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Live change tracking
+ *
+ * Once a device has been announced, every directory on it gets an inotify
+ * watch, so that files written, moved or deleted there are noticed right
+ * away rather than whenever LMS happens to scan again. A thread collects
+ * the changes until they stop for a while, then reports the entries that
+ * changed along with their directories, which are the only ones to scan.
+ *
+ * Watches are limited to MEDIA_WATCH_MAX for all devices, handed out
+ * breadth first so that deep trees lose their deepest directories first;
+ * changes in directories left unwatched are left to LMS. When the kernel
+ * drops events, the watched devices are reported as changed as a whole.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                    IN_DELETE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* Changes keep being collected at most this many debounce periods */
+#define WATCH_MAX_DELAY 5
+
+typedef struct {
+    gboolean add;
+    gchar *root;
+} WatchCommand_t;
+
+static struct {
+    MediaWatchFunc func;
+    int fd;                 /* inotify */
+    int cmdfd;              /* eventfd, commands are waiting */
+    int epfd;
+    GAsyncQueue *commands;  /* WatchCommand_t */
+    GThread *thread;
+    GHashTable *wds;        /* watch descriptor -> directory */
+    GHashTable *dirs;       /* directory -> watch descriptor */
+    GHashTable *roots;      /* mount paths of the watched devices */
+    GHashTable *scan;       /* directories to scan again */
+    GHashTable *added;      /* entries created or written */
+    GHashTable *removed;    /* entries deleted or moved away */
+    gint64 first;           /* monotonic time of the oldest change */
+    gint watches;
+    gint overflows;
+    gint truncated;
+} watcher = { .fd = -1, .cmdfd = -1, .epfd = -1 };
+
+static gboolean path_is_within(const gchar *path, const gchar *root)
+{
+    const gsize len = strlen(root);
+
+    return strncmp(path, root, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/');
+}
+
+/* Mount path of the watched device 'path' is on, or NULL */
+static const gchar *watch_root_of(const gchar *path)
+{
+    GHashTableIter iter;
+    gpointer root;
+
+    g_hash_table_iter_init(&iter, watcher.roots);
+    while (g_hash_table_iter_next(&iter, &root, NULL)) {
+        if (path_is_within(path, root))
+            return root;
+    }
+    return NULL;
+}
+
+static void watch_forget(gint wd)
+{
+    gchar *dir = g_hash_table_lookup(watcher.wds, GINT_TO_POINTER(wd));
+
+    if (!dir)
+        return;
+    g_hash_table_remove(watcher.dirs, dir);
+    g_hash_table_remove(watcher.wds, GINT_TO_POINTER(wd));
+    g_atomic_int_set(&watcher.watches, g_hash_table_size(watcher.wds));
+}
+
+/* Stop watching the directories at or below 'top' */
+static void watch_remove_tree(const gchar *top)
+{
+    GHashTableIter iter;
+    gpointer dir, wd;
+    GList *wds = NULL, *l;
+
+    g_hash_table_iter_init(&iter, watcher.dirs);
+    while (g_hash_table_iter_next(&iter, &dir, &wd)) {
+        if (path_is_within(dir, top))
+            wds = g_list_prepend(wds, wd);
+    }
+
+    for (l = wds; l; l = l->next) {
+        inotify_rm_watch(watcher.fd, GPOINTER_TO_INT(l->data));
+        watch_forget(GPOINTER_TO_INT(l->data));
+    }
+    g_list_free(wds);
+}
+
+/* Watch 'top' and the directories below it, breadth first, within budget */
+static void watch_add_tree(const gchar *top)
+{
+    GQueue queue = G_QUEUE_INIT;
+    gchar *dir;
+
+    g_queue_push_tail(&queue, g_strdup(top));
+    while ((dir = g_queue_pop_head(&queue))) {
+        struct dirent *entry;
+        DIR *d;
+        int wd;
+
+        if (g_hash_table_contains(watcher.dirs, dir)) {
+            g_free(dir);
+            continue;
+        }
+
+        wd = g_hash_table_size(watcher.wds) < MEDIA_WATCH_MAX ?
+             inotify_add_watch(watcher.fd, dir, WATCH_MASK) : -1;
+        if (wd < 0 && (errno == ENOSPC ||
+                       g_hash_table_size(watcher.wds) >= MEDIA_WATCH_MAX)) {
+            LOGE("Out of watches, changes below %s are left to LMS\n", dir);
+            g_atomic_int_inc(&watcher.truncated);
+            g_free(dir);
+            break;
+        }
+        if (wd < 0) {
+            g_free(dir);
+            continue;
+        }
+
+        g_hash_table_insert(watcher.wds, GINT_TO_POINTER(wd), dir);
+        g_hash_table_insert(watcher.dirs, dir, GINT_TO_POINTER(wd));
+
+        d = opendir(dir);
+        if (!d)
+            continue;
+        while ((entry = readdir(d))) {
+            gchar *child;
+
+            if (entry->d_name[0] == '.' ||
+                (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN))
+                continue;
+            child = g_build_filename(dir, entry->d_name, NULL);
+            if (entry->d_type == DT_DIR ||
+                (g_file_test(child, G_FILE_TEST_IS_DIR) &&
+                 !g_file_test(child, G_FILE_TEST_IS_SYMLINK)))
+                g_queue_push_tail(&queue, child);
+            else
+                g_free(child);
+        }
+        closedir(d);
+    }
+
+    while ((dir = g_queue_pop_head(&queue)))
+        g_free(dir);
+    g_atomic_int_set(&watcher.watches, g_hash_table_size(watcher.wds));
+}
+
+/* Drop the changes collected at or below 'top' */
+static void watch_drop_changes(GHashTable *changes, const gchar *top)
+{
+    GHashTableIter iter;
+    gpointer path;
+
+    g_hash_table_iter_init(&iter, changes);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        if (path_is_within(path, top))
+            g_hash_table_iter_remove(&iter);
+    }
+}
+
+static void watch_change(GHashTable *changes, const gchar *path)
+{
+    if (!watcher.first)
+        watcher.first = g_get_monotonic_time();
+    g_hash_table_add(changes, g_strdup(path));
+}
+
+/* Events were lost: every watched device may have changed */
+static void watch_overflow(void)
+{
+    GHashTableIter iter;
+    gpointer root;
+
+    LOGE("Missed changes, scanning the watched devices again\n");
+    g_atomic_int_inc(&watcher.overflows);
+
+    g_hash_table_iter_init(&iter, watcher.roots);
+    while (g_hash_table_iter_next(&iter, &root, NULL)) {
+        watch_change(watcher.scan, root);
+        watch_change(watcher.added, root);
+    }
+}
+
+static void watch_event(const struct inotify_event *ev)
+{
+    const gchar *dir;
+    gchar *path;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        watch_overflow();
+        return;
+    }
+    if (ev->mask & IN_IGNORED) {
+        watch_forget(ev->wd);
+        return;
+    }
+
+    dir = g_hash_table_lookup(watcher.wds, GINT_TO_POINTER(ev->wd));
+    if (!dir || !ev->len || ev->name[0] == '.')
+        return;
+    path = g_build_filename(dir, ev->name, NULL);
+
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (ev->mask & IN_ISDIR)
+            watch_remove_tree(path);
+        g_hash_table_remove(watcher.added, path);
+        watch_drop_changes(watcher.scan, path);
+        watch_change(watcher.removed, path);
+        watch_change(watcher.scan, dir);
+    } else if (ev->mask & IN_ISDIR) {
+        /* A new directory may come with files already, e.g. moved in */
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch_add_tree(path);
+            watch_change(watcher.added, path);
+            watch_change(watcher.scan, path);
+        }
+    } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        watch_change(watcher.added, path);
+        watch_change(watcher.scan, dir);
+    }
+
+    g_free(path);
+}
+
+static void watch_read_events(void)
+{
+    gchar buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(watcher.fd, buf, sizeof(buf))) > 0) {
+        const gchar *ptr = buf;
+
+        while (ptr < buf + len) {
+            const struct inotify_event *ev = (const struct inotify_event *) ptr;
+
+            watch_event(ev);
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+static void watch_run_commands(void)
+{
+    WatchCommand_t *cmd;
+    guint64 count;
+
+    if (read(watcher.cmdfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOGE("Cannot read watch commands: %s\n", g_strerror(errno));
+
+    while ((cmd = g_async_queue_try_pop(watcher.commands))) {
+        if (cmd->add) {
+            g_hash_table_add(watcher.roots, g_strdup(cmd->root));
+            watch_add_tree(cmd->root);
+        } else {
+            watch_remove_tree(cmd->root);
+            g_hash_table_remove(watcher.roots, cmd->root);
+            watch_drop_changes(watcher.scan, cmd->root);
+            watch_drop_changes(watcher.added, cmd->root);
+            watch_drop_changes(watcher.removed, cmd->root);
+        }
+        g_free(cmd->root);
+        g_free(cmd);
+    }
+}
+
+static gchar **watch_take(GHashTable *changes)
+{
+    gchar **paths = (gchar **) g_hash_table_get_keys_as_array(changes, NULL);
+    guint i;
+
+    for (i = 0; paths[i]; i++)
+        paths[i] = g_strdup(paths[i]);
+    g_hash_table_remove_all(changes);
+    return paths;
+}
+
+static gboolean watch_report(gpointer data)
+{
+    MediaWatchChanges_t *changes = data;
+
+    watcher.func(changes);
+    g_strfreev(changes->scan);
+    g_strfreev(changes->added);
+    g_strfreev(changes->removed);
+    g_free(changes);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Hand the collected changes to the manager event loop. Past
+ * MEDIA_WATCH_DELTA_MAX entries, the changed directories are reported
+ * instead of their entries, then the devices themselves.
+ */
+static void watch_flush(void)
+{
+    MediaWatchChanges_t *changes = g_malloc0(sizeof(*changes));
+    GHashTableIter iter;
+    gpointer path;
+
+    if (g_hash_table_size(watcher.added) > MEDIA_WATCH_DELTA_MAX) {
+        g_hash_table_remove_all(watcher.added);
+        g_hash_table_iter_init(&iter, watcher.scan);
+        while (g_hash_table_iter_next(&iter, &path, NULL))
+            g_hash_table_add(watcher.added, g_strdup(path));
+    }
+    if (g_hash_table_size(watcher.scan) > MEDIA_WATCH_DELTA_MAX) {
+        g_hash_table_remove_all(watcher.added);
+        g_hash_table_iter_init(&iter, watcher.scan);
+        while (g_hash_table_iter_next(&iter, &path, NULL)) {
+            const gchar *root = watch_root_of(path);
+
+            if (root)
+                g_hash_table_add(watcher.added, g_strdup(root));
+        }
+        g_hash_table_remove_all(watcher.scan);
+        g_hash_table_iter_init(&iter, watcher.added);
+        while (g_hash_table_iter_next(&iter, &path, NULL))
+            g_hash_table_add(watcher.scan, g_strdup(path));
+    }
+
+    changes->scan = watch_take(watcher.scan);
+    changes->added = watch_take(watcher.added);
+    changes->removed = watch_take(watcher.removed);
+    watcher.first = 0;
+
+    LOGD("%u directories changed\n", g_strv_length(changes->scan));
+    g_idle_add(watch_report, changes);
+}
+
+/* Time the collected changes must be reported by */
+static gint64 watch_deadline(void)
+{
+    return watcher.first +
+           WATCH_MAX_DELAY * MEDIA_WATCH_DEBOUNCE * G_TIME_SPAN_MILLISECOND;
+}
+
+static void *watch_thread(void *unused)
+{
+    struct epoll_event evs[2];
+    int timeout;
+    int ret, i;
+
+    for (;;) {
+        timeout = -1;
+        if (watcher.first) {
+            /* Wait for a quiet period, but not forever */
+            timeout = MIN(MEDIA_WATCH_DEBOUNCE,
+                          MAX(0, (watch_deadline() - g_get_monotonic_time()) /
+                                 G_TIME_SPAN_MILLISECOND));
+        }
+
+        ret = epoll_wait(watcher.epfd, evs, G_N_ELEMENTS(evs), timeout);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            LOGE("Cannot wait for file changes: %s\n", g_strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < ret; i++) {
+            if (evs[i].data.fd == watcher.fd)
+                watch_read_events();
+            else
+                watch_run_commands();
+        }
+
+        if (watcher.first &&
+            (ret == 0 || g_get_monotonic_time() >= watch_deadline()))
+            watch_flush();
+    }
+
+    return NULL;
+}
+
+static void watch_command(gboolean add, const gchar *root)
+{
+    WatchCommand_t *cmd;
+    const guint64 one = 1;
+
+    if (!watcher.thread)
+        return;
+
+    cmd = g_malloc0(sizeof(*cmd));
+    cmd->add = add;
+    cmd->root = g_strdup(root);
+    g_async_queue_push(watcher.commands, cmd);
+    if (write(watcher.cmdfd, &one, sizeof(one)) < 0)
+        LOGE("Cannot queue watch command: %s\n", g_strerror(errno));
+}
+
+/* Start tracking changes on the device mounted at 'root' */
+void media_watch_add(const gchar *root)
+{
+    watch_command(TRUE, root);
+}
+
+/* Stop tracking changes on the device mounted at 'root' */
+void media_watch_remove(const gchar *root)
+{
+    watch_command(FALSE, root);
+}
+
+void media_watch_stats(MediaWatchStats_t *stats)
+{
+    stats->watches = g_atomic_int_get(&watcher.watches);
+    stats->overflows = g_atomic_int_get(&watcher.overflows);
+    stats->truncated = g_atomic_int_get(&watcher.truncated);
+}
+
+/*
+ * Start the watcher thread. 'func' is called on the default main context
+ * with the changes seen on the watched devices.
+ */
+int media_watch_init(MediaWatchFunc func)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    watcher.func = func;
+    watcher.wds = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                        NULL, g_free);
+    watcher.dirs = g_hash_table_new(g_str_hash, g_str_equal);
+    watcher.roots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    watcher.scan = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    watcher.added = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    watcher.removed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    watcher.commands = g_async_queue_new();
+
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watcher.cmdfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    watcher.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (watcher.fd < 0 || watcher.cmdfd < 0 || watcher.epfd < 0) {
+        LOGE("Cannot watch file changes: %s\n", g_strerror(errno));
+        goto fail;
+    }
+
+    ev.data.fd = watcher.fd;
+    if (epoll_ctl(watcher.epfd, EPOLL_CTL_ADD, watcher.fd, &ev) < 0)
+        goto fail;
+    ev.data.fd = watcher.cmdfd;
+    if (epoll_ctl(watcher.epfd, EPOLL_CTL_ADD, watcher.cmdfd, &ev) < 0)
+        goto fail;
+
+    watcher.thread = g_thread_try_new("media-watch", watch_thread, NULL, NULL);
+    if (!watcher.thread) {
+        LOGE("Cannot start the file change thread\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (watcher.epfd >= 0)
+        close(watcher.epfd);
+    if (watcher.cmdfd >= 0)
+        close(watcher.cmdfd);
+    if (watcher.fd >= 0)
+        close(watcher.fd);
+    watcher.epfd = watcher.cmdfd = watcher.fd = -1;
+    return -1;
+}
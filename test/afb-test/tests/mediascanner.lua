@@ -18,8 +18,53 @@
 
 
 _AFT.testVerbStatusSuccess('testMedia_resultSuccess','mediascanner','media_result', {})
+_AFT.testVerbStatusSuccess('testMedia_resultLimitSuccess','mediascanner','media_result', {limit=10})
+_AFT.testVerbStatusError('testMedia_resultLimitError','mediascanner','media_result', {limit=0})
+_AFT.testVerbStatusError('testMedia_resultCursorError','mediascanner','media_result', {cursor="invalid"})
+
+_AFT.testVerbStatusError('testMedia_resultDeviceError','mediascanner','media_result', {device="/media/none"})
+
+_AFT.testVerbStatusSuccess('testMedia_resultFilterSuccess','mediascanner','media_result', {filter={artist="none", title="a", min_duration=1000, max_duration=600000}})
+_AFT.testVerbStatusError('testMedia_resultFilterFieldError','mediascanner','media_result', {filter={composer="none"}})
+_AFT.testVerbStatusError('testMedia_resultFilterRangeError','mediascanner','media_result', {filter={min_duration=2000, max_duration=1000}})
+_AFT.testVerbStatusError('testMedia_resultFilterDurationTypeError','mediascanner','media_result', {filter={min_duration="abc"}})
+
+_AFT.testVerbStatusSuccess('testMedia_resultFieldsSuccess','mediascanner','media_result', {fields={"title","duration"}})
+_AFT.testVerbStatusSuccess('testMedia_resultFieldsListSuccess','mediascanner','media_result', {fields="path"})
+_AFT.testVerbStatusError('testMedia_resultFieldsError','mediascanner','media_result', {fields={"composer"}})
+
+_AFT.testVerbStatusSuccess('testStatsSuccess','mediascanner','stats', {})
+_AFT.testVerbStatusSuccess('testDevicesSuccess','mediascanner','devices', {})
+_AFT.testVerbStatusSuccess('testSummarySuccess','mediascanner','summary', {})
+_AFT.testVerbStatusError('testSummaryDeviceError','mediascanner','summary', {device="/media/none"})
+
+_AFT.testVerbStatusError('testRescanPathError','mediascanner','rescan', {})
+_AFT.testVerbStatusError('testRescanRelativePathError','mediascanner','rescan', {path="media/sda1"})
+_AFT.testVerbStatusError('testRescanTypeError','mediascanner','rescan', {path="/media", types="invalid"})
+_AFT.testVerbStatusError('testRescanRootPathError','mediascanner','rescan', {path="/"})
+_AFT.testVerbStatusError('testRescanSystemPathError','mediascanner','rescan', {path="/usr"})
+
+_AFT.testVerbStatusSuccess('testSearchSuccess','mediascanner','search', {query="a"})
+_AFT.testVerbStatusSuccess('testSearchTypesSuccess','mediascanner','search', {query="a", types="audio", limit=10})
+_AFT.testVerbStatusError('testSearchQueryError','mediascanner','search', {})
+_AFT.testVerbStatusError('testSearchEmptyQueryError','mediascanner','search', {query="*"})
+
+_AFT.testVerbStatusSuccess('testArtistsSuccess','mediascanner','artists', {})
+_AFT.testVerbStatusSuccess('testAlbumsSuccess','mediascanner','albums', {})
+_AFT.testVerbStatusSuccess('testAlbumsArtistSuccess','mediascanner','albums', {artist="none"})
+_AFT.testVerbStatusSuccess('testGenresSuccess','mediascanner','genres', {})
+_AFT.testVerbStatusSuccess('testTracksSuccess','mediascanner','tracks', {album="none"})
+_AFT.testVerbStatusSuccess('testTracksFieldsSuccess','mediascanner','tracks', {album="none", fields="path"})
+_AFT.testVerbStatusError('testTracksAlbumError','mediascanner','tracks', {})
+_AFT.testVerbStatusError('testArtistsDeviceError','mediascanner','artists', {device="/nonexistent"})
+_AFT.testVerbStatusError('testTracksDeviceError','mediascanner','tracks', {album="none", device="/nonexistent"})
 
 _AFT.testVerbStatusSuccess('testSubscribeAddSuccess','mediascanner','subscribe', {value="media_added"})
+_AFT.testVerbStatusSuccess('testSubscribeAddChunkedSuccess','mediascanner','subscribe', {value="media_added", chunk_size=100})
+_AFT.testVerbStatusError('testSubscribeAddChunkedError','mediascanner','subscribe', {value="media_added", chunk_size=-1})
+_AFT.testVerbStatusError('testSubscribeAddChunkedTypeError','mediascanner','subscribe', {value="media_added", chunk_size={}})
+_AFT.testVerbStatusSuccess('testSubscribeAddChunkedStringSuccess','mediascanner','subscribe', {value="media_added", chunk_size="100"})
+_AFT.testVerbStatusError('testSubscribeAddChunkedStringError','mediascanner','subscribe', {value="media_added", chunk_size="abc"})
 _AFT.testVerbStatusSuccess('testSubscribeRemoveSuccess','mediascanner','subscribe', {value="media_removed"})
 
 _AFT.testVerbStatusSuccess('testUnsubscribeAddSuccess','mediascanner','unsubscribe', {value="media_added"})
@@ -0,0 +1,161 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Check with EXPLAIN QUERY PLAN that the binding's queries reach their
+ * rows through an index search instead of a table scan: files by a range
+ * of files.path, for listings, summaries and library views alike, files
+ * added during a scan by a range of files.id, the tracks of an album by
+ * audios.album_id. Audio media and tracks asked for their paths only
+ * must not join the artist, album and genre tables, and the queries a
+ * device is streamed with must not sort.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "media-manager.h"
+
+/* Subset of the lightmediascanner schema the queries rely on */
+static const char *lms_schema =
+    "CREATE TABLE files (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+    "path BLOB NOT NULL UNIQUE, mtime INTEGER NOT NULL, "
+    "dtime INTEGER NOT NULL, itime INTEGER NOT NULL, "
+    "size INTEGER NOT NULL, update_id INTEGER NOT NULL);"
+    "CREATE TABLE audio_artists (id INTEGER PRIMARY KEY, name TEXT UNIQUE);"
+    "CREATE TABLE audio_albums (id INTEGER PRIMARY KEY, artist_id INTEGER, "
+    "name TEXT);"
+    "CREATE TABLE audio_genres (id INTEGER PRIMARY KEY, name TEXT UNIQUE);"
+    "CREATE TABLE audios (id INTEGER PRIMARY KEY, title TEXT, "
+    "album_id INTEGER, artist_id INTEGER, genre_id INTEGER, "
+    "trackno INTEGER, rating INTEGER, playcnt INTEGER, length INTEGER);"
+    "CREATE INDEX audios_artist_idx ON audios (artist_id);"
+    "CREATE INDEX audios_album_idx ON audios (album_id);"
+    "CREATE INDEX audios_genre_idx ON audios (genre_id);"
+    "CREATE TABLE videos (id INTEGER PRIMARY KEY, title TEXT, artist TEXT, "
+    "length INTEGER);"
+    "CREATE TABLE images (id INTEGER PRIMARY KEY, title TEXT, date INTEGER, "
+    "width INTEGER, height INTEGER);";
+
+#define PATH_RANGE  "(path>? AND path<?)"
+#define ALBUM_INDEX "(album_id=?)"
+#define ID_RANGE    "(rowid>?)"
+
+static const struct {
+    const char *name;
+    const char *sql;
+    const char *table;  /* table searched ... */
+    const char *cond;   /* ... with this index constraint */
+    int paths_only;     /* joins no name table */
+    int unsorted;       /* uses no temporary B-tree */
+} queries[] = {
+    { MEDIA_AUDIO, AUDIO_SQL_QUERY, "files", PATH_RANGE },
+    { "audio paths", AUDIO_SQL_PATHS, "files", PATH_RANGE, 1 },
+    { "audio filter", AUDIO_SQL_QUERY_MATCH, "files", PATH_RANGE },
+    { MEDIA_VIDEO, VIDEO_SQL_QUERY, "files", PATH_RANGE },
+    { MEDIA_IMAGE, IMAGE_SQL_QUERY, "files", PATH_RANGE },
+    { "audio progress", AUDIO_SQL_PROGRESS, "files", ID_RANGE },
+    { "video progress", VIDEO_SQL_PROGRESS, "files", ID_RANGE },
+    { "image progress", IMAGE_SQL_PROGRESS, "files", ID_RANGE },
+    { "audio stream", AUDIO_SQL_STREAM, "files", PATH_RANGE, 0, 1 },
+    { "video stream", VIDEO_SQL_STREAM, "files", PATH_RANGE, 0, 1 },
+    { "image stream", IMAGE_SQL_STREAM, "files", PATH_RANGE, 0, 1 },
+    { "audio summary", AUDIO_SQL_SUMMARY, "files", PATH_RANGE },
+    { "video summary", VIDEO_SQL_SUMMARY, "files", PATH_RANGE },
+    { "image summary", IMAGE_SQL_SUMMARY, "files", PATH_RANGE },
+    { "artists", BROWSE_SQL_ARTISTS, "files", PATH_RANGE },
+    { "albums", BROWSE_SQL_ALBUMS, "files", PATH_RANGE },
+    { "genres", BROWSE_SQL_GENRES, "files", PATH_RANGE },
+    { "tracks", BROWSE_SQL_TRACKS, "audios", ALBUM_INDEX },
+    { "track paths", BROWSE_SQL_TRACK_PATHS, "audios", ALBUM_INDEX, 1 },
+};
+
+/* Whether a plan step reads one of the artist, album or genre tables */
+static int joins_names(const char *detail)
+{
+    return strncmp(detail, "SEARCH audio_artists USING INTEGER", 34) == 0 ||
+           strncmp(detail, "SEARCH audio_albums USING INTEGER", 33) == 0 ||
+           strncmp(detail, "SEARCH audio_genres USING INTEGER", 33) == 0;
+}
+
+/*
+ * Return 1 when the plan of 'sql' searches 'table' with 'cond', if
+ * 'paths_only' never joins a name table and, if 'unsorted', never sorts.
+ */
+static int uses_index(sqlite3 *db, const char *sql, const char *table,
+                      const char *cond, int paths_only, int unsorted)
+{
+    sqlite3_stmt *res;
+    char *explain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql);
+    size_t len = strlen(table);
+    int found = 0, joined = 0, sorted = 0;
+
+    if (sqlite3_prepare_v2(db, explain, -1, &res, NULL) != SQLITE_OK) {
+        fprintf(stderr, "cannot prepare: %s\n", sqlite3_errmsg(db));
+        sqlite3_free(explain);
+        return 0;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        const char *detail = (const char *) sqlite3_column_text(res, 3);
+
+        printf("#   %s\n", detail);
+        if (strncmp(detail, "SEARCH ", 7) == 0 &&
+            strncmp(detail + 7, table, len) == 0 &&
+            strncmp(detail + 7 + len, " USING", 6) == 0 &&
+            strstr(detail, cond))
+            found = 1;
+        if (joins_names(detail))
+            joined = 1;
+        if (strncmp(detail, "USE TEMP B-TREE", 15) == 0)
+            sorted = 1;
+    }
+
+    sqlite3_finalize(res);
+    sqlite3_free(explain);
+    return found && !(paths_only && joined) && !(unsorted && sorted);
+}
+
+int main(void)
+{
+    sqlite3 *db;
+    unsigned int i;
+    int failed = 0;
+
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK ||
+        sqlite3_exec(db, lms_schema, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "cannot create test database\n");
+        return 1;
+    }
+
+    printf("1..%u\n", (unsigned int) (sizeof(queries) / sizeof(queries[0])));
+    for (i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        int ok = uses_index(db, queries[i].sql, queries[i].table,
+                            queries[i].cond, queries[i].paths_only,
+                            queries[i].unsorted);
+
+        printf("%s %u - %s query searches %s %s%s%s\n",
+               ok ? "ok" : "not ok", i + 1, queries[i].name,
+               queries[i].table, queries[i].cond,
+               queries[i].paths_only ? " without joins" : "",
+               queries[i].unsorted ? " without sorting" : "");
+        failed |= !ok;
+    }
+
+    sqlite3_close(db);
+    return failed;
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright 2026 Konsulko Group
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Compare the file existence check backends of the validator on the
+ * files below a directory, e.g. the mount point of a USB stick:
+ *
+ *   media-stat-bench /media/sda1
+ *
+ * Run as root so that the page cache can be dropped before each pass,
+ * otherwise only the first pass runs on a cold cache.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "media-manager.h"
+
+static void collect_files(const gchar *dir, GPtrArray *paths)
+{
+    GDir *d = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+
+    if (!d)
+        return;
+
+    while ((name = g_dir_read_name(d)) != NULL) {
+        gchar *path = g_build_filename(dir, name, NULL);
+
+        if (g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+            g_free(path);
+        } else if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+            collect_files(path, paths);
+            g_free(path);
+        } else {
+            g_ptr_array_add(paths, path);
+        }
+    }
+    g_dir_close(d);
+}
+
+static gboolean drop_caches(void)
+{
+    FILE *f;
+
+    sync();
+    f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (!f)
+        return FALSE;
+    fputs("3\n", f);
+    return fclose(f) == 0;
+}
+
+static void run(MediaStatBackend_t backend, GPtrArray *paths)
+{
+    MediaStatBatch_t *batch = media_stat_batch_new(backend);
+    gboolean exists[MEDIA_VALIDATOR_BATCH];
+    gboolean cold = drop_caches();
+    guint i, n, found = 0;
+    gint64 start, elapsed;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < paths->len; i += n) {
+        guint j;
+
+        n = MIN(MEDIA_VALIDATOR_BATCH, paths->len - i);
+        media_stat_batch_check(batch, (gchar **) &paths->pdata[i], exists, n);
+        for (j = 0; j < n; j++)
+            found += exists[j];
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    printf("%-10s %8u files %8u found %10.3f ms %8.2f us/file%s\n",
+           media_stat_backend_name(media_stat_batch_backend(batch)),
+           paths->len, found, elapsed / 1000.0,
+           paths->len ? (double) elapsed / paths->len : 0.0,
+           cold ? "" : " (page cache not dropped)");
+
+    media_stat_batch_free(batch);
+}
+
+int main(int argc, char *argv[])
+{
+    GPtrArray *paths;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <directory>\n", argv[0]);
+        return 1;
+    }
+
+    paths = g_ptr_array_new_with_free_func(g_free);
+    collect_files(argv[1], paths);
+
+    run(MEDIA_STAT_SERIAL, paths);
+    run(MEDIA_STAT_THREADS, paths);
+    run(MEDIA_STAT_URING, paths);
+
+    g_ptr_array_free(paths, TRUE);
+    return 0;
+}